@@ -0,0 +1,489 @@
+// Benchmarks every built-in filter and separator, and bitmap loading and
+// saving, over a range of image sizes and shapes. Built on its own, apart
+// from the main program:
+//     g++ -std=c++11 -O2 -o benchmark Benchmark.cpp -lpthread
+// Run it with --help for its options.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Exceptions.h"
+#include "ImageCommand.h"
+
+using namespace std;
+using namespace IManip;
+
+/** A help message displaying the benchmark's options */
+const string BENCHMARK_USAGE =
+    "Usage: benchmark [options...]\n"
+    "--min-size <int>\tthe smallest image side, at least 64, 64 by default\n"
+    "--max-size <int>\tthe largest image side, 4096 by default, up to 16384\n"
+    "--min-time <int>\tthe least milliseconds to time each case for, 200 by default\n"
+    "--only <name>\tonly run cases whose name contains the text\n"
+    "--threads <int>\tthe number of threads to filter with, one per core by default\n"
+    "--json <file>\twrite the results as JSON, one case per line\n"
+    "--baseline <file>\tcompare against results written earlier with --json\n"
+    "--tolerance <double>\tthe fraction slower than the baseline that counts as a regression, 0.1 by default\n";
+
+/**
+ * Options for a benchmark run.
+ */
+struct BenchmarkOptions {
+    /** the smallest image side */
+    int minSize;
+    /** the largest image side */
+    int maxSize;
+    /** the least time to spend timing each case, in milliseconds */
+    int minTime;
+    /** only cases whose names contain this are run */
+    string only;
+    /** the file to write JSON results to, or empty */
+    string jsonFilename;
+    /** the JSON results to compare against, or empty */
+    string baselineFilename;
+    /** the fraction slower than the baseline that counts as a regression */
+    double tolerance;
+
+    /**
+     * Creates the default options.
+     */
+    BenchmarkOptions() : minSize(64), maxSize(4096), minTime(200), tolerance(0.1) { }
+};
+
+/**
+ * The timing of one operation on one image size.
+ */
+struct BenchmarkResult {
+    /** the operation, such as "ci" or "load" */
+    string name;
+    /** the width of the source image */
+    int width;
+    /** the height of the source image */
+    int height;
+    /** the nanoseconds taken for each source pixel */
+    double nsPerPixel;
+    /** the gigabytes of source and result pixels gone through each second */
+    double gbPerSecond;
+    /** the pixel buffers each run took from the buffer pool, recycled or not */
+    double poolBuffers;
+    /** the pixel buffers each run had to get from the system rather than the pool */
+    double freshAllocations;
+
+    /**
+     * Gets the key the result is matched to its baseline by.
+     * @return the name and size of the case
+     */
+    string getKey() const {
+        stringstream stream;
+        stream << name << " " << width << "x" << height;
+        return stream.str();
+    }
+};
+
+/**
+ * One operation to be timed. It is run on a source image, and reports the
+ * number of result pixels it wrote so that throughput counts both sides.
+ */
+struct BenchmarkCase {
+    /** the name of the operation */
+    string name;
+    /** runs the operation, returning the number of result pixels */
+    std::function<size_t(const RGBImage&)> run;
+};
+
+/**
+ * Makes an image of the given size filled with noise, the same every time.
+ * @param width the width of the image
+ * @param height the height of the image
+ * @return the image
+ */
+RGBImage makeNoise(int width, int height) {
+    RGBImage img(width, height, false);
+    PixelRows<RGBPixel> rows = img.getRows();
+    unsigned state = 12345;
+    for(int y = 0; y < height; y++)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            state = state * 1664525u + 1013904223u;
+            rows[y][x] = RGBPixel(state >> 24, state >> 16, state >> 8);
+        }
+    }
+    return img;
+}
+
+/**
+ * Makes a case that runs a filter parsed from command line style arguments.
+ * @param text the filter and its arguments, separated by spaces
+ * @return the case
+ */
+BenchmarkCase makeCommandCase(const string& text) {
+    vector<string> words;
+    stringstream stream(text);
+    string word;
+    while(stream >> word)
+    {
+        words.push_back(word);
+    }
+    vector<const char*> argv;
+    for(int i = 0; i < words.size(); i++)
+    {
+        argv.push_back(words[i].c_str());
+    }
+    int index = 0;
+    ImageCommand command = parseCommand(index, argv.size(), &argv[0]);
+
+    BenchmarkCase benchmarkCase;
+    benchmarkCase.name = text;
+    benchmarkCase.run = [command](const RGBImage& srcImg) {
+        size_t pixels = 0;
+        if(command.getFilter())
+        {
+            RGBImage result = command.getFilter()->filter(srcImg);
+            pixels = (size_t)result.getWidth() * result.getHeight();
+        }
+        else
+        {
+            vector<RGBImage> results = command.getSeparator()->separate(srcImg);
+            for(int i = 0; i < results.size(); i++)
+            {
+                pixels += (size_t)results[i].getWidth() * results[i].getHeight();
+            }
+        }
+        return pixels;
+    };
+    return benchmarkCase;
+}
+
+/**
+ * Gets every case to be timed: each built-in filter and separator, and
+ * bitmap saving and loading.
+ * @param scratchFilename a file the bitmap cases can write to
+ * @return the cases
+ */
+vector<BenchmarkCase> getBenchmarkCases(const string& scratchFilename) {
+    const char* commands[] = {
+        "ca 0.75 0.5 0.3", "cg 2.2 1.0 0.45", "ci", "cl 20 230",
+        "ir 1", "ir 2", "iref",
+        "irs nearest 0.5", "irs bilinear 0.5", "irs area 0.5", "irs lanczos 1.5", "is 2",
+        "cs", "isl 3 3"
+    };
+    vector<BenchmarkCase> cases;
+    for(int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        cases.push_back(makeCommandCase(commands[i]));
+    }
+
+    // a crop on its own is a view of the source that costs nothing, so the
+    // case crops to the middle half of each side and copies the crop, as the
+    // first filter to write to it would
+    BenchmarkCase crop;
+    crop.name = "ic half, copied";
+    crop.run = [](const RGBImage& srcImg) {
+        int width = srcImg.getWidth();
+        int height = srcImg.getHeight();
+        RGBImage cropped = ImageCropper(width / 4, height / 4, width * 3 / 4, height * 3 / 4).filter(srcImg);
+        cropped.makeUnique();
+        return (size_t)cropped.getWidth() * cropped.getHeight();
+    };
+    cases.push_back(crop);
+
+    BenchmarkCase save;
+    save.name = "save";
+    save.run = [scratchFilename](const RGBImage& srcImg) {
+        saveImage(scratchFilename, srcImg);
+        return (size_t)0;
+    };
+    cases.push_back(save);
+    BenchmarkCase load;
+    load.name = "load";
+    load.run = [scratchFilename](const RGBImage&) {
+        RGBImage loaded(scratchFilename);
+        return (size_t)0;
+    };
+    cases.push_back(load);
+    BenchmarkCase mapped;
+    mapped.name = "load --mmap";
+    mapped.run = [scratchFilename](const RGBImage&) {
+        MappedBitmap bitmap(scratchFilename);
+        RGBImage decoded = bitmap.decode();
+        return (size_t)0;
+    };
+    cases.push_back(mapped);
+    return cases;
+}
+
+/**
+ * Times one case on one image. The case is run once to warm up, and then
+ * repeatedly until the minimum time has passed.
+ * @param benchmarkCase the case to time
+ * @param srcImg the image to run it on
+ * @param minTime the least time to spend timing, in milliseconds
+ * @return the timing
+ */
+BenchmarkResult timeCase(const BenchmarkCase& benchmarkCase, const RGBImage& srcImg, int minTime) {
+    typedef std::chrono::steady_clock Clock;
+    size_t resultPixels = benchmarkCase.run(srcImg);
+
+    long runs = 0;
+    BufferPoolStats statsBefore = getBufferPool().getStats();
+    Clock::time_point start = Clock::now();
+    Clock::duration elapsed;
+    do
+    {
+        benchmarkCase.run(srcImg);
+        runs++;
+        elapsed = Clock::now() - start;
+    }
+    while(elapsed < std::chrono::milliseconds(minTime));
+
+    double seconds = std::chrono::duration<double>(elapsed).count() / runs;
+    size_t srcPixels = (size_t)srcImg.getWidth() * srcImg.getHeight();
+    BenchmarkResult result;
+    result.name = benchmarkCase.name;
+    result.width = srcImg.getWidth();
+    result.height = srcImg.getHeight();
+    result.nsPerPixel = seconds * 1e9 / srcPixels;
+    result.gbPerSecond = (double)(srcPixels + resultPixels) * PIXEL_SIZE / seconds / 1e9;
+    BufferPoolStats statsAfter = getBufferPool().getStats();
+    result.poolBuffers = (double)(statsAfter.hits + statsAfter.misses - statsBefore.hits - statsBefore.misses) / runs;
+    result.freshAllocations = (double)(statsAfter.misses - statsBefore.misses) / runs;
+    return result;
+}
+
+/**
+ * Writes results as JSON, with one case to a line so that the file can be
+ * diffed and read back by readBaseline.
+ * @param filename the file to write
+ * @param results the results to write
+ * @throws FileException if the file cannot be written
+ */
+void writeJson(const string& filename, const vector<BenchmarkResult>& results) {
+    ofstream ofs(filename.c_str());
+    ofs << "{\"threads\": " << getThreadPool().getThreadCount()
+        << ", \"simd\": " << getSimdLevel() << ", \"cases\": [\n";
+    for(int i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult& result = results[i];
+        ofs << "  {\"name\": \"" << result.name << "\", \"width\": " << result.width
+            << ", \"height\": " << result.height << ", \"ns_per_pixel\": " << result.nsPerPixel
+            << ", \"gb_per_s\": " << result.gbPerSecond << ", \"pool_buffers\": " << result.poolBuffers
+            << ", \"fresh_allocations\": " << result.freshAllocations
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    ofs << "]}\n";
+    ofs.close();
+    if(!ofs)
+    {
+        throw FileException(filename, "File cannot be written");
+    }
+}
+
+/**
+ * Finds the value of a field in a line written by writeJson.
+ * @param line the line
+ * @param field the name of the field
+ * @return the text of the value, without quotes, or empty if there is none
+ */
+string getJsonField(const string& line, const string& field) {
+    size_t start = line.find("\"" + field + "\": ");
+    if(start == string::npos)
+    {
+        return "";
+    }
+    start += field.size() + 4;
+    if(line[start] == '"')
+    {
+        start++;
+        return line.substr(start, line.find('"', start) - start);
+    }
+    return line.substr(start, line.find_first_of(",}", start) - start);
+}
+
+/**
+ * Reads results written earlier by writeJson.
+ * @param filename the file to read
+ * @return the nanoseconds per pixel of each case, keyed by BenchmarkResult::getKey
+ * @throws FileException if the file cannot be read
+ */
+map<string, double> readBaseline(const string& filename) {
+    ifstream ifs(filename.c_str());
+    if(!ifs.good())
+    {
+        throw FileException(filename, "Baseline cannot be read or does not exist");
+    }
+    map<string, double> baseline;
+    string line;
+    while(getline(ifs, line))
+    {
+        string name = getJsonField(line, "name");
+        if(name.empty())
+        {
+            continue;
+        }
+        BenchmarkResult result;
+        result.name = name;
+        result.width = atoi(getJsonField(line, "width").c_str());
+        result.height = atoi(getJsonField(line, "height").c_str());
+        baseline[result.getKey()] = atof(getJsonField(line, "ns_per_pixel").c_str());
+    }
+    return baseline;
+}
+
+/**
+ * Parses the benchmark's options.
+ * @param argc the number of arguments
+ * @param argv the arguments, after the program name
+ * @return the options
+ * @throws IllegalArgumentException if an option is not known or is missing its argument
+ */
+BenchmarkOptions parseBenchmarkOptions(int argc, const char** argv) {
+    BenchmarkOptions options;
+    int index = 0;
+    while(index < argc)
+    {
+        string option = argv[index++];
+        if(option == "--help")
+        {
+            throw IllegalArgumentException(BENCHMARK_USAGE);
+        }
+        assertArgCount(1, option + " requires an argument", index, argc, argv);
+        string value = argv[index++];
+        if(option == "--min-size")
+        {
+            options.minSize = atoi(value.c_str());
+        }
+        else if(option == "--max-size")
+        {
+            options.maxSize = atoi(value.c_str());
+        }
+        else if(option == "--min-time")
+        {
+            options.minTime = atoi(value.c_str());
+        }
+        else if(option == "--only")
+        {
+            options.only = value;
+        }
+        else if(option == "--threads")
+        {
+            getThreadPool().setThreadCount(atoi(value.c_str()));
+        }
+        else if(option == "--json")
+        {
+            options.jsonFilename = value;
+        }
+        else if(option == "--baseline")
+        {
+            options.baselineFilename = value;
+        }
+        else if(option == "--tolerance")
+        {
+            options.tolerance = atof(value.c_str());
+        }
+        else
+        {
+            throw IllegalArgumentException("Unknown option: \"" + option + "\"\n" + BENCHMARK_USAGE);
+        }
+    }
+    if(options.minSize < 64 || options.maxSize < options.minSize || options.maxSize > 16384)
+    {
+        throw IllegalArgumentException("Sizes must be from 64 to 16384, smallest first");
+    }
+    return options;
+}
+
+/**
+ * Times every case on square, wide and tall images of each size, from the
+ * smallest side to the largest, four times as many pixels each step. Wide and
+ * tall images have the same number of pixels as the square one, in a 4:1
+ * shape. Prints a table, and optionally writes and compares JSON.
+ * @return 1 if any case regressed against the baseline, 0 otherwise
+ */
+int runBenchmarks(const BenchmarkOptions& options) {
+    string scratchFilename = "benchmark_scratch.bmp";
+    vector<BenchmarkCase> cases = getBenchmarkCases(scratchFilename);
+    map<string, double> baseline;
+    if(!options.baselineFilename.empty())
+    {
+        baseline = readBaseline(options.baselineFilename);
+    }
+
+    cout << left << setw(20) << "case" << setw(14) << "size" << right << setw(12) << "ns/pixel"
+         << setw(10) << "GB/s" << setw(10) << "pool bufs" << setw(10) << "fresh" << setw(10) << "change" << endl;
+    vector<BenchmarkResult> results;
+    int regressions = 0;
+    for(int side = options.minSize; side <= options.maxSize; side *= 2)
+    {
+        int shapes[3][2] = { { side, side }, { side * 2, side / 2 }, { side / 2, side * 2 } };
+        for(int shape = 0; shape < 3; shape++)
+        {
+            RGBImage srcImg = makeNoise(shapes[shape][0], shapes[shape][1]);
+            for(int i = 0; i < cases.size(); i++)
+            {
+                if(!options.only.empty() && cases[i].name.find(options.only) == string::npos)
+                {
+                    continue;
+                }
+                // the load cases read back a bitmap of the source image
+                if(cases[i].name.compare(0, 4, "load") == 0)
+                {
+                    saveImage(scratchFilename, srcImg);
+                }
+                BenchmarkResult result = timeCase(cases[i], srcImg, options.minTime);
+                results.push_back(result);
+
+                stringstream size;
+                size << result.width << "x" << result.height;
+                cout << left << setw(20) << result.name << setw(14) << size.str() << right << fixed
+                     << setprecision(3) << setw(12) << result.nsPerPixel << setw(10) << result.gbPerSecond
+                     << setprecision(1) << setw(10) << result.poolBuffers << setw(10) << result.freshAllocations;
+                map<string, double>::iterator base = baseline.find(result.getKey());
+                if(base != baseline.end() && base->second > 0)
+                {
+                    double change = result.nsPerPixel / base->second - 1;
+                    cout << setw(9) << showpos << change * 100 << "%" << noshowpos;
+                    if(change > options.tolerance)
+                    {
+                        cout << "  REGRESSION";
+                        regressions++;
+                    }
+                }
+                cout << endl;
+            }
+        }
+    }
+    remove(scratchFilename.c_str());
+
+    if(!options.jsonFilename.empty())
+    {
+        writeJson(options.jsonFilename, results);
+    }
+    if(regressions > 0)
+    {
+        cout << regressions << " cases were more than " << options.tolerance * 100
+             << "% slower than the baseline" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, const char** argv) {
+    try {
+        return runBenchmarks(parseBenchmarkOptions(argc - 1, argv + 1));
+    }
+    catch(FileException ex) {
+        cout << ex.getMessage() << ": " << ex.getFilename() << endl;
+    }
+    catch(Exception ex) {
+        cout << ex.getMessage() << endl;
+    }
+    return 2;
+}
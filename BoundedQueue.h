@@ -0,0 +1,99 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include "Exceptions.h"
+
+namespace IManip {
+
+/**
+ * BoundedQueue hands items from producer threads to consumer threads, holding
+ * at most a fixed number at once. Producers wait while it is full, so a fast
+ * stage of a pipeline can't run ahead of a slow one and fill memory with
+ * items waiting to be processed. Once the producers are done they close the
+ * queue, and consumers get everything left in it before being told it is
+ * empty.
+ */
+template <class Item>
+class BoundedQueue {
+private:
+    /** the items waiting to be taken */
+    std::deque<Item> items;
+    /** the most items the queue holds at once */
+    size_t capacity;
+    /** whether any more items can be put in */
+    bool closed;
+    /** guards items and closed */
+    std::mutex lock;
+    /** signalled when an item is put in or the queue is closed */
+    std::condition_variable notEmpty;
+    /** signalled when an item is taken out */
+    std::condition_variable notFull;
+
+    BoundedQueue(const BoundedQueue&);
+    BoundedQueue& operator=(const BoundedQueue&);
+public:
+    /**
+     * Creates an empty, open queue.
+     * @param capacity the most items the queue holds at once, at least 1
+     * @throws IllegalArgumentException if capacity is 0
+     */
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {
+        if(capacity < 1)
+        {
+            throw IllegalArgumentException("A bounded queue needs a capacity of at least 1.");
+        }
+    }
+
+    /**
+     * Puts an item at the back of the queue, waiting while the queue is full.
+     * @param item the item to put in
+     * @throws IllegalArgumentException if the queue has been closed
+     */
+    void push(Item item) {
+        std::unique_lock<std::mutex> guard(lock);
+        notFull.wait(guard, [this] { return closed || items.size() < capacity; });
+        if(closed)
+        {
+            throw IllegalArgumentException("Cannot push to a closed queue.");
+        }
+        items.push_back(std::move(item));
+        guard.unlock();
+        notEmpty.notify_one();
+    }
+    /**
+     * Takes the item at the front of the queue, waiting while the queue is
+     * empty and still open.
+     * @param item set to the item taken
+     * @return true if an item was taken, false if the queue is closed and empty
+     */
+    bool pop(Item& item) {
+        std::unique_lock<std::mutex> guard(lock);
+        notEmpty.wait(guard, [this] { return closed || !items.empty(); });
+        if(items.empty())
+        {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        guard.unlock();
+        notFull.notify_one();
+        return true;
+    }
+    /**
+     * Closes the queue. Nothing more can be put in, and consumers are told
+     * the queue is empty once they have taken what is left.
+     */
+    void close() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+};
+
+}
@@ -0,0 +1,236 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace IManip {
+
+/** alignment in bytes of the start of every pixel buffer, one cache line */
+const int BUFFER_ALIGNMENT = 64;
+/** the smallest size class, in bytes */
+const size_t BUFFER_POOL_MIN_CLASS = 4096;
+/** the most bytes of idle buffers the shared pool keeps by default, 1GB */
+const size_t BUFFER_POOL_DEFAULT_LIMIT = (size_t)1 << 30;
+
+/**
+ * Counters describing how well a BufferPool is recycling buffers.
+ */
+struct BufferPoolStats {
+    /** the number of allocations served from an idle buffer */
+    size_t hits;
+    /** the number of allocations that needed a new buffer */
+    size_t misses;
+    /** the number of buffers released back to the pool */
+    size_t releases;
+    /** the number of idle buffers waiting to be reused */
+    size_t idleBuffers;
+    /** the total capacity of the idle buffers in bytes */
+    size_t idleBytes;
+    /** the total number of bytes asked for by every allocation */
+    size_t allocatedBytes;
+
+    /**
+     * Creates a set of counters that are all zero.
+     */
+    BufferPoolStats() : hits(0), misses(0), releases(0), idleBuffers(0), idleBytes(0), allocatedBytes(0) { }
+};
+
+/**
+ * BufferPool recycles the large aligned buffers that images keep their pixels
+ * in. A pipeline of filters allocates and releases a full size image at every
+ * stage, and a batch run does the same for every image, so released buffers
+ * are kept and handed out again instead of going back to the system, where
+ * each new buffer would cost page faults all over again.
+ *
+ * Buffers are grouped into size classes, four per power of two, so a buffer
+ * can be reused for any request up to a quarter smaller than it. Idle buffers
+ * are kept until their total size reaches the pool's limit, after which
+ * released buffers are freed. Every method is thread safe.
+ */
+class BufferPool {
+private:
+    /**
+     * Sits just before every aligned buffer, recording what is needed to
+     * recycle or free it.
+     */
+    struct BlockHeader {
+        /** the start of the underlying allocation */
+        char* raw;
+        /** the number of usable bytes from the aligned start */
+        size_t capacity;
+    };
+
+    /** idle buffers, keyed by their capacity */
+    std::map<size_t, std::vector<char*> > idle;
+    /** the counters for this pool */
+    BufferPoolStats stats;
+    /** the most bytes of idle buffers to keep */
+    size_t limit;
+    /** guards everything above */
+    std::mutex lock;
+
+    /**
+     * Gets the header stashed before an aligned buffer.
+     * @param block the aligned buffer
+     * @return a pointer to its header
+     */
+    static BlockHeader* getHeader(char* block) {
+        return reinterpret_cast<BlockHeader*>(block - sizeof(BlockHeader));
+    }
+
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+public:
+    /**
+     * Rounds a size up to its size class.
+     * @param bytes the number of bytes wanted
+     * @return the capacity of the buffers that such a request is served from
+     */
+    static size_t getSizeClass(size_t bytes) {
+        if(bytes <= BUFFER_POOL_MIN_CLASS)
+        {
+            return BUFFER_POOL_MIN_CLASS;
+        }
+        size_t power = BUFFER_POOL_MIN_CLASS;
+        while(power * 2 <= bytes)
+        {
+            power *= 2;
+        }
+        size_t step = power / 4;
+        return (bytes + step - 1) / step * step;
+    }
+
+    /**
+     * Creates an empty pool.
+     * @param limit the most bytes of idle buffers to keep
+     */
+    explicit BufferPool(size_t limit = BUFFER_POOL_DEFAULT_LIMIT) : limit(limit) { }
+    /**
+     * Frees all of the idle buffers. Every buffer handed out must have been
+     * released by now.
+     */
+    ~BufferPool() {
+        trim();
+    }
+
+    /**
+     * Gets a buffer of at least the given size, aligned to BUFFER_ALIGNMENT.
+     * Its contents are whatever was last written to it unless zeroed is set.
+     * @param bytes the number of bytes needed
+     * @param zeroed whether the buffer must be filled with zeros
+     * @return the start of the buffer, to be handed back with release
+     */
+    void* allocate(size_t bytes, bool zeroed) {
+        size_t capacity = getSizeClass(bytes);
+        char* block = 0;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stats.allocatedBytes += bytes;
+            std::map<size_t, std::vector<char*> >::iterator it = idle.find(capacity);
+            if(it != idle.end() && !it->second.empty())
+            {
+                block = it->second.back();
+                it->second.pop_back();
+                stats.hits++;
+                stats.idleBuffers--;
+                stats.idleBytes -= capacity;
+            }
+            else
+            {
+                stats.misses++;
+            }
+        }
+        if(!block)
+        {
+            char* raw = new char[capacity + BUFFER_ALIGNMENT + sizeof(BlockHeader)];
+            size_t address = reinterpret_cast<size_t>(raw + sizeof(BlockHeader));
+            block = raw + sizeof(BlockHeader) + (BUFFER_ALIGNMENT - address % BUFFER_ALIGNMENT) % BUFFER_ALIGNMENT;
+            getHeader(block)->raw = raw;
+            getHeader(block)->capacity = capacity;
+        }
+        if(zeroed)
+        {
+            std::memset(block, 0, bytes);
+        }
+        return block;
+    }
+    /**
+     * Hands a buffer back to the pool, to be reused or freed.
+     * @param buffer a buffer from allocate, may be null
+     */
+    void release(void* buffer) {
+        if(!buffer)
+        {
+            return;
+        }
+        char* block = static_cast<char*>(buffer);
+        size_t capacity = getHeader(block)->capacity;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stats.releases++;
+            if(stats.idleBytes + capacity <= limit)
+            {
+                idle[capacity].push_back(block);
+                stats.idleBuffers++;
+                stats.idleBytes += capacity;
+                return;
+            }
+        }
+        delete[] getHeader(block)->raw;
+    }
+    /**
+     * Frees every idle buffer, handing the memory back to the system.
+     */
+    void trim() {
+        std::lock_guard<std::mutex> guard(lock);
+        for(std::map<size_t, std::vector<char*> >::iterator it = idle.begin(); it != idle.end(); ++it)
+        {
+            for(size_t i = 0; i < it->second.size(); i++)
+            {
+                delete[] getHeader(it->second[i])->raw;
+            }
+        }
+        idle.clear();
+        stats.idleBuffers = 0;
+        stats.idleBytes = 0;
+    }
+
+    /**
+     * Changes how many bytes of idle buffers the pool keeps. Idle buffers
+     * over the new limit are freed.
+     * @param limit the most bytes of idle buffers to keep, 0 to keep none
+     */
+    void setLimit(size_t limit) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            this->limit = limit;
+            if(stats.idleBytes <= limit)
+            {
+                return;
+            }
+        }
+        trim();
+    }
+    /**
+     * Gets the counters for this pool.
+     * @return a snapshot of the counters
+     */
+    BufferPoolStats getStats() {
+        std::lock_guard<std::mutex> guard(lock);
+        return stats;
+    }
+};
+
+/**
+ * Gets the buffer pool that every image in the process allocates from. It is
+ * never destroyed, so images may safely outlive any other static object.
+ * @return the shared pool
+ */
+BufferPool& getBufferPool() {
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include "Exceptions.h"
+#include "PixelFormats.h"
+#include "PixelImage.h"
+#include "RGBImage.h"
+
+namespace IManip {
+
+/**
+ * ChannelImage holds a single 8-bit channel of an image, one byte per pixel,
+ * such as one of the planes that ColorSplitter splits an image into, or a
+ * gray image. It takes a third of the memory of an RGBImage of the same size.
+ * It is a PixelImage of Gray8 pixels, so every row starts on a
+ * BUFFER_ALIGNMENT boundary, and it is filtered with invertImage, curveImage
+ * and remapPixelImage.
+ *
+ * There is no 8-bit bitmap format, so a ChannelImage is saved either as a
+ * gray 24-bit image with savePixelImage, or back in one channel of a 24-bit
+ * image with saveChannelImage.
+ */
+typedef PixelImage<Gray8> ChannelImage;
+
+/**
+ * Puts the values of a ChannelImage into one channel of a 24-bit image, with
+ * the other two channels black. Splitting an image with ColorSplitter and
+ * putting each plane back into its own channel gives the same images as
+ * ColorSplitter::separate.
+ * @param srcImg the image to convert
+ * @param channel the channel to put the values in: 0 for red, 1 for green, 2 for blue
+ * @return a 24-bit image of the same size
+ * @throws IllegalArgumentException if the channel is not 0, 1 or 2
+ */
+RGBImage toRGBImage(const ChannelImage& srcImg, int channel) {
+    if(channel < 0 || channel >= PIXEL_SIZE)
+    {
+        std::stringstream stream;
+        stream << "Channel must be 0, 1 or 2, not " << channel;
+        throw IllegalArgumentException(stream.str());
+    }
+    RGBImage rgbImage(srcImg.getWidth(), srcImg.getHeight(), false);
+    PixelRows<const Gray8> srcRows = srcImg.getRows();
+    PixelRows<RGBPixel> destRows = rgbImage.getRows();
+    for(int y = 0; y < srcRows.getHeight(); y++)
+    {
+        PixelSpan<const Gray8> srcRow = srcRows[y];
+        byte* destRow = reinterpret_cast<byte*>(destRows[y].data());
+        std::fill(destRow, destRow + (size_t)srcRow.size()*PIXEL_SIZE, 0);
+        for(int x = 0; x < srcRow.size(); x++)
+        {
+            destRow[x*PIXEL_SIZE + channel] = srcRow[x].v;
+        }
+    }
+    return rgbImage;
+}
+
+/**
+ * Saves a ChannelImage as a 24-bit bitmap, with its values in one channel.
+ * @param filename the name of the file to write to
+ * @param srcImg the image to save
+ * @param channel the channel to put the values in: 0 for red, 1 for green, 2 for blue
+ * @throws FileException if the file cannot be written
+ * @throws IllegalArgumentException if the channel is not 0, 1 or 2
+ */
+void saveChannelImage(std::string filename, const ChannelImage& srcImg, int channel) {
+    saveImage(filename, toRGBImage(srcImg, channel));
+}
+
+}
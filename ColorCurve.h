@@ -0,0 +1,120 @@
+#pragma once
+#include <memory>
+#include "PixelFilter.h"
+
+namespace IManip {
+
+/** the number of values a color channel can take */
+const int CHANNEL_VALUES = BYTE_MAX + 1;
+
+/**
+ * ColorCurve is the base class for filters that map each color channel
+ * through a tone curve of its own, such as amplification, gamma correction or
+ * levels. The curves are stored as three 256 entry lookup tables, so every
+ * curve costs one table lookup per channel however it was calculated.
+ * Subclasses fill the tables in their constructors with setCurve, and curves
+ * that follow one another compose into a single curve.
+ */
+class ColorCurve : public PixelFilter {
+private:
+    /** the lookup tables for red, green and blue, in that order */
+    byte curves[PIXEL_SIZE][CHANNEL_VALUES];
+protected:
+    /**
+     * Constructs a curve that leaves every color unchanged, for subclasses to
+     * fill in.
+     */
+    ColorCurve() {
+        for(int channel = 0; channel < PIXEL_SIZE; channel++)
+        {
+            for(int value = 0; value < CHANNEL_VALUES; value++)
+            {
+                curves[channel][value] = value;
+            }
+        }
+    }
+    /**
+     * Sets the result of the curve for one value of one channel.
+     * @param channel the channel, 0 for red, 1 for green and 2 for blue
+     * @param value the source value
+     * @param result the value that the source value is mapped to
+     */
+    void setCurve(int channel, byte value, byte result) {
+        curves[channel][value] = result;
+    }
+public:
+    /**
+     * Constructs a curve from user supplied lookup tables.
+     * @param red the 256 results of the curve for red
+     * @param green the 256 results of the curve for green
+     * @param blue the 256 results of the curve for blue
+     */
+    ColorCurve(const byte* red, const byte* green, const byte* blue) {
+        std::copy(red, red + CHANNEL_VALUES, curves[0]);
+        std::copy(green, green + CHANNEL_VALUES, curves[1]);
+        std::copy(blue, blue + CHANNEL_VALUES, curves[2]);
+    }
+
+    /**
+     * Gets the result of the curve for one value of one channel.
+     * @param channel the channel, 0 for red, 1 for green and 2 for blue
+     * @param value the source value
+     * @return the value that the source value is mapped to
+     */
+    byte getCurve(int channel, byte value) const {
+        return curves[channel][value];
+    }
+
+    /**
+     * Composes this curve with one applied after it.
+     * @param next the curve applied to the result of this one
+     * @return a single curve that has the effect of this one followed by next
+     */
+    ColorCurve then(const ColorCurve& next) const {
+        ColorCurve composed;
+        for(int channel = 0; channel < PIXEL_SIZE; channel++)
+        {
+            for(int value = 0; value < CHANNEL_VALUES; value++)
+            {
+                composed.curves[channel][value] = next.curves[channel][curves[channel][value]];
+            }
+        }
+        return composed;
+    }
+    /**
+     * Composes this curve with a following pointwise filter if that filter is
+     * also a curve.
+     * @param next the filter applied after this one
+     * @return the composed curve, or null if next isn't a ColorCurve
+     */
+    virtual std::shared_ptr<PixelFilter> composeWith(const PixelFilter& next) const {
+        const ColorCurve* nextCurve = dynamic_cast<const ColorCurve*>(&next);
+        if(!nextCurve)
+        {
+            return std::shared_ptr<PixelFilter>();
+        }
+        return std::make_shared<ColorCurve>(then(*nextCurve));
+    }
+
+    /**
+     * Maps each channel of each source pixel through its lookup table.
+     * @param src the first of the source pixels
+     * @param dest the first of the pixels to write the mapped pixels to
+     * @param count the number of pixels to map
+     */
+    virtual void filterPixels(const RGBPixel* src, RGBPixel* dest, int count) {
+        const byte* red = curves[0];
+        const byte* green = curves[1];
+        const byte* blue = curves[2];
+        for(int i = 0; i < count; i++)
+        {
+            // read the whole pixel first, so that filtering in place is safe
+            RGBPixel pix = src[i];
+            dest[i].r = red[pix.r];
+            dest[i].g = green[pix.g];
+            dest[i].b = blue[pix.b];
+        }
+    }
+};
+
+}
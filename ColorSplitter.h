@@ -1,6 +1,9 @@
 #pragma once
 #include "ImageSeparator.h"
-#include "ColorAmplifier.h"
+#include "ChannelImage.h"
+#include "MappedBitmap.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
 
 namespace IManip {
 
@@ -8,39 +11,118 @@ namespace IManip {
  * ColorSplitter splits an image into into its component subimages by 
  * masking a given image with red, green, and blue filters. It returns 
  * three images, one for each color. It takes no arguments in its constructor.
+ * It can also split an image into planes of one byte per pixel with
+ * splitChannels, which take a third of the memory.
  */
 class ColorSplitter : public ImageSeparator {
-private:
-    /** Filter to separate out the red coloration of an image */
-    ColorAmplifier redFilter;
-    /** Filter to separate out the green coloration of an image */
-    ColorAmplifier greenFilter;
-    /** Filter to separate out the blue coloration of an image */
-    ColorAmplifier blueFilter;
 public:
     /**
      * Constructs a ColorSplitter that will split a given image into its red,
      * green, and blue componenents. Does not take any arguments.
      */
-    ColorSplitter() : redFilter(1,0,0), greenFilter(0,1,0), blueFilter(0,0,1) { }
+    ColorSplitter() { }
     
     /**
      * Separates the source image into red, green, and blue component images.
      * The vector returned will contain three images, one for each color.
      * Each image is created by masking the source image, transferring only
-     * the values of a certain color to the destination pixel.
+     * the values of a certain color to the destination pixel. All three are
+     * written in a single pass over the source, in bands of rows spread over
+     * the shared thread pool.
      * @param srcImg the image to be separated into component images.
      * @return a vector containing the three component images: red, green, blue
      */
     virtual std::vector<RGBImage> separate(const RGBImage& srcImg) {
+        int width = srcImg.getWidth();
         std::vector<RGBImage> images;
+        for(int channel = 0; channel < PIXEL_SIZE; channel++)
+        {
+            images.push_back(RGBImage(width, srcImg.getHeight(), false));
+        }
         
-        images.push_back(redFilter.filter(srcImg));
-        images.push_back(greenFilter.filter(srcImg));
-        images.push_back(blueFilter.filter(srcImg));
+        PixelRows<const RGBPixel> srcRows = srcImg.getRows();
+        PixelRows<RGBPixel> redRows = images[0].getRows();
+        PixelRows<RGBPixel> greenRows = images[1].getRows();
+        PixelRows<RGBPixel> blueRows = images[2].getRows();
+        parallelForRows(width, srcImg.getHeight(), [&](int begin, int end) {
+            for(int y = begin; y < end; y++)
+            {
+                PixelSpan<const RGBPixel> src = srcRows[y];
+                PixelSpan<RGBPixel> red = redRows[y];
+                PixelSpan<RGBPixel> green = greenRows[y];
+                PixelSpan<RGBPixel> blue = blueRows[y];
+                for(int x = 0; x < width; x++)
+                {
+                    red[x] = RGBPixel(src[x].r, 0, 0);
+                    green[x] = RGBPixel(0, src[x].g, 0);
+                    blue[x] = RGBPixel(0, 0, src[x].b);
+                }
+            }
+        });
         
         return images;
     }
+    
+    /**
+     * Splits the source image into red, green, and blue planes, one byte per
+     * pixel. Each row is de-interleaved in one pass by splitChannels, which
+     * uses byte shuffles where the CPU has them. A plane can be saved as the
+     * matching image from separate with toRGBImage(const ChannelImage&, int).
+     * @param srcImg the image to be split into planes.
+     * @return a vector containing the three planes: red, green, blue
+     */
+    std::vector<ChannelImage> splitChannels(const RGBImage& srcImg) {
+        int width = srcImg.getWidth();
+        std::vector<ChannelImage> planes;
+        for(int channel = 0; channel < PIXEL_SIZE; channel++)
+        {
+            planes.push_back(ChannelImage(width, srcImg.getHeight(), false));
+        }
+        
+        PixelRows<const RGBPixel> srcRows = srcImg.getRows();
+        PixelRows<Gray8> redRows = planes[0].getRows();
+        PixelRows<Gray8> greenRows = planes[1].getRows();
+        PixelRows<Gray8> blueRows = planes[2].getRows();
+        parallelForRows(width, srcImg.getHeight(), [&](int begin, int end) {
+            for(int y = begin; y < end; y++)
+            {
+                IManip::splitChannels(reinterpret_cast<const byte*>(srcRows[y].data()),
+                                      &redRows[y].data()->v, &greenRows[y].data()->v,
+                                      &blueRows[y].data()->v, width);
+            }
+        });
+        
+        return planes;
+    }
+    /**
+     * Splits a mapped bitmap into red, green, and blue planes straight from
+     * its scanlines, so that no 24-bit copy of the image is ever made. The
+     * scanlines are stored b,g,r, so splitChannels gives the planes in that
+     * order.
+     * @param srcImg the mapped bitmap to be split into planes.
+     * @return a vector containing the three planes: red, green, blue
+     */
+    std::vector<ChannelImage> splitChannels(const MappedBitmap& srcImg) {
+        int width = srcImg.getWidth();
+        std::vector<ChannelImage> planes;
+        for(int channel = 0; channel < PIXEL_SIZE; channel++)
+        {
+            planes.push_back(ChannelImage(width, srcImg.getHeight(), false));
+        }
+        
+        PixelRows<Gray8> redRows = planes[0].getRows();
+        PixelRows<Gray8> greenRows = planes[1].getRows();
+        PixelRows<Gray8> blueRows = planes[2].getRows();
+        parallelForRows(width, srcImg.getHeight(), [&](int begin, int end) {
+            for(int y = begin; y < end; y++)
+            {
+                IManip::splitChannels(srcImg.getScanline(y), &blueRows[y].data()->v,
+                                      &greenRows[y].data()->v, &redRows[y].data()->v, width);
+            }
+        });
+        
+        return planes;
+    }
 };
 
 }
@@ -0,0 +1,48 @@
+#pragma once
+#include <cmath>
+#include "ColorCurve.h"
+#include "Exceptions.h"
+
+namespace IManip {
+
+/**
+ * GammaCorrector applies a gamma curve to the colors of an image. Each color
+ * value v becomes BYTE_MAX * (v/BYTE_MAX)^(1/gamma), so a gamma greater than 1
+ * brightens the midtones and a gamma less than 1 darkens them, while black
+ * and white are left alone. Each channel has its own gamma.
+ */
+class GammaCorrector : public ColorCurve {
+private:
+    /**
+     * Applies a gamma curve to a single color value.
+     * @param value the initial value
+     * @param gamma the gamma to apply, greater than 0
+     * @return the corrected value, rounded to the nearest byte
+     */
+    static byte correct(byte value, double gamma) {
+        double corrected = BYTE_MAX * std::pow(value / (double)BYTE_MAX, 1 / gamma);
+        return (byte)(corrected + 0.5);
+    }
+public:
+    /**
+     * Constructs a GammaCorrector with the given gamma for each channel.
+     * @param redGamma the gamma for red, must be greater than 0
+     * @param greenGamma the gamma for green, must be greater than 0
+     * @param blueGamma the gamma for blue, must be greater than 0
+     * @throws IllegalArgumentException if any of the gammas are not greater than 0
+     */
+    GammaCorrector(double redGamma, double greenGamma, double blueGamma) {
+        if(!(redGamma > 0 && greenGamma > 0 && blueGamma > 0))
+        {
+            throw IllegalArgumentException("Gamma values must be greater than 0.");
+        }
+        for(int value = 0; value < CHANNEL_VALUES; value++)
+        {
+            setCurve(0, value, correct(value, redGamma));
+            setCurve(1, value, correct(value, greenGamma));
+            setCurve(2, value, correct(value, blueGamma));
+        }
+    }
+};
+
+}
@@ -0,0 +1,346 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include "ImageFilter.h"
+#include "Exceptions.h"
+#include "ThreadPool.h"
+
+namespace IManip {
+
+/**
+ * PixelRemap describes a filter that only moves pixels around, such as a
+ * rotation, reflection or crop. For every pixel (x, y) of the remapped image
+ * it gives the coordinates of the source pixel that is copied there:
+ *     srcX = x0 + x*xStepX + y*yStepX
+ *     srcY = y0 + x*xStepY + y*yStepY
+ * so the steps say how far through the source one pixel to the right (x) or
+ * one pixel down (y) in the remapped image moves. Remaps compose, so a whole
+ * chain of geometric filters can be collapsed into a single remap.
+ */
+struct PixelRemap {
+    /** the width of the remapped image in pixels */
+    int width;
+    /** the height of the remapped image in pixels */
+    int height;
+    /** the source x coordinate of the top left remapped pixel */
+    int x0;
+    /** the source y coordinate of the top left remapped pixel */
+    int y0;
+    /** the change in source x for one pixel to the right */
+    int xStepX;
+    /** the change in source y for one pixel to the right */
+    int xStepY;
+    /** the change in source x for one pixel down */
+    int yStepX;
+    /** the change in source y for one pixel down */
+    int yStepY;
+
+    /**
+     * Creates a remap from all of its values.
+     */
+    PixelRemap(int width, int height, int x0, int y0,
+               int xStepX, int xStepY, int yStepX, int yStepY)
+        : width(width), height(height), x0(x0), y0(y0),
+          xStepX(xStepX), xStepY(xStepY), yStepX(yStepX), yStepY(yStepY) { }
+
+    /**
+     * Creates a remap that leaves an image of the given size unchanged.
+     * @param width the width of the image
+     * @param height the height of the image
+     * @return the identity remap
+     */
+    static PixelRemap identity(int width, int height) {
+        return PixelRemap(width, height, 0, 0, 1, 0, 0, 1);
+    }
+
+    /**
+     * Composes this remap with one applied after it.
+     * @param next the remap applied to the result of this one
+     * @return a single remap that has the effect of this one followed by next
+     */
+    PixelRemap then(const PixelRemap& next) const {
+        return PixelRemap(next.width, next.height,
+                x0 + next.x0*xStepX + next.y0*yStepX,
+                y0 + next.x0*xStepY + next.y0*yStepY,
+                next.xStepX*xStepX + next.xStepY*yStepX,
+                next.xStepX*xStepY + next.xStepY*yStepY,
+                next.yStepX*xStepX + next.yStepY*yStepX,
+                next.yStepX*xStepY + next.yStepY*yStepY);
+    }
+
+    /**
+     * Checks if this remap leaves a source image of the given size unchanged.
+     * @param srcWidth the width of the source image
+     * @param srcHeight the height of the source image
+     * @return true if the remap is the identity for the source image
+     */
+    bool isIdentity(int srcWidth, int srcHeight) const {
+        return width == srcWidth && height == srcHeight
+            && x0 == 0 && y0 == 0
+            && xStepX == 1 && xStepY == 0 && yStepX == 0 && yStepY == 1;
+    }
+
+    /**
+     * Makes sure that the remapped image has valid dimensions and that every
+     * pixel of it comes from inside a source image of the given size. Since
+     * the remap is linear, checking the corners is enough.
+     * @param srcWidth the width of the source image
+     * @param srcHeight the height of the source image
+     * @throws IllegalArgumentException if either remapped dimension is negative
+     * @throws IndexOutOfBoundsException if a pixel comes from outside the source
+     */
+    void assertValid(int srcWidth, int srcHeight) const {
+        if(width < 0 || height < 0)
+        {
+            std::stringstream stream;
+            stream << "Dimensions must be greater than zero. Width: "
+                   << width << " Height: " << height << "\n";
+            throw IllegalArgumentException(stream.str());
+        }
+        if(width == 0 || height == 0)
+        {
+            return;
+        }
+        int cornersX[] = {0, width - 1, 0, width - 1};
+        int cornersY[] = {0, 0, height - 1, height - 1};
+        for(int i = 0; i < 4; i++)
+        {
+            int srcX = x0 + cornersX[i]*xStepX + cornersY[i]*yStepX;
+            int srcY = y0 + cornersX[i]*xStepY + cornersY[i]*yStepY;
+            if(srcX < 0 || srcX >= srcWidth || srcY < 0 || srcY >= srcHeight)
+            {
+                std::stringstream stream;
+                stream << "Bounds error: (" << srcX << "," << srcY
+                       << "), width: " << srcWidth << " height: " << srcHeight;
+                throw IndexOutOfBoundsException(stream.str());
+            }
+        }
+    }
+};
+
+/**
+ * the size in pixels of the square blocks that remaps which turn source
+ * columns into rows are gathered in. A block of each image is 12KB, so both
+ * stay in the L1 cache.
+ */
+const int REMAP_BLOCK_SIZE = 64;
+
+/**
+ * Applies a remap to an image in a single gather pass over the remapped image.
+ * A remap that only cuts out a rectangle of the source, such as a crop, just
+ * returns a subImage that shares the source's pixels, without copying any.
+ * Otherwise, rows that run straight along a source row are copied whole, and
+ * rows that run backwards along one, as in a half turn, are copied in reverse. Any other
+ * remap, such as a quarter turn, walks down source columns, so it is gathered
+ * a square block at a time: the source rows that a block reads stay in cache
+ * until the block is done, instead of every remapped row touching every
+ * source row. Bands of rows are gathered on the shared thread pool.
+ * @param srcImg the source image
+ * @param remap the remap to apply, which must fit the source image
+ * @return the remapped image
+ * @throws IllegalArgumentException if a remapped dimension is negative
+ * @throws IndexOutOfBoundsException if the remap reaches outside the source
+ */
+RGBImage remapImage(const RGBImage& srcImg, const PixelRemap& remap) {
+    remap.assertValid(srcImg.getWidth(), srcImg.getHeight());
+    if(remap.width == 0 || remap.height == 0)
+    {
+        return RGBImage(remap.width, remap.height);
+    }
+    if(remap.xStepX == 1 && remap.xStepY == 0 && remap.yStepX == 0 && remap.yStepY == 1)
+    {
+        return srcImg.subImage(remap.x0, remap.y0, remap.width, remap.height);
+    }
+    RGBImage remappedImage(remap.width, remap.height, false);
+    PixelRows<RGBPixel> destRows = remappedImage.getRows();
+
+    const RGBPixel* srcPixels = srcImg.getRows()[0].data();
+    // how far through the source buffer one remapped pixel to the right moves
+    std::ptrdiff_t step = (std::ptrdiff_t)remap.xStepY*srcImg.getStride() + remap.xStepX;
+    // the first source pixel of a remapped row
+    auto rowStart = [&](int y) {
+        return srcPixels
+                + (std::ptrdiff_t)(remap.y0 + y*remap.yStepY)*srcImg.getStride()
+                + (remap.x0 + y*remap.yStepX);
+    };
+
+    if(step == 1 || step == -1)
+    {
+        parallelForRows(remap.width, remap.height, [&](int begin, int end) {
+            for(int y = begin; y < end; y++)
+            {
+                const RGBPixel* src = rowStart(y);
+                RGBPixel* dest = destRows[y].data();
+                if(step == 1)
+                {
+                    std::copy(src, src + remap.width, dest);
+                }
+                else
+                {
+                    std::reverse_copy(src - remap.width + 1, src + 1, dest);
+                }
+            }
+        });
+        return remappedImage;
+    }
+
+    parallelFor(0, remap.height, REMAP_BLOCK_SIZE, [&](int begin, int end) {
+        for(int blockX = 0; blockX < remap.width; blockX += REMAP_BLOCK_SIZE)
+        {
+            int blockEnd = std::min(remap.width, blockX + REMAP_BLOCK_SIZE);
+            for(int y = begin; y < end; y++)
+            {
+                const RGBPixel* src = rowStart(y) + blockX*step;
+                RGBPixel* dest = destRows[y].data();
+                for(int x = blockX; x < blockEnd; x++, src += step)
+                {
+                    dest[x] = *src;
+                }
+            }
+        }
+    });
+    return remappedImage;
+}
+
+/**
+ * Flips an image over the top of itself, for remaps that only reverse the
+ * direction of the rows, the columns or both, such as a reflection or a half
+ * turn. Pairs of pixels are swapped, so nothing is allocated.
+ * @param img the image to flip, which is changed
+ * @param flipX whether to reverse every row
+ * @param flipY whether to reverse the order of the rows
+ */
+void flipImage(RGBImage& img, bool flipX, bool flipY) {
+    PixelRows<RGBPixel> pixels = img.getRows();
+    int width = img.getWidth();
+    int height = img.getHeight();
+    // each band covers the top rows of some pairs of rows, mirrored at the bottom
+    int rows = flipY ? (height + 1) / 2 : height;
+    parallelForRows(width * (flipY ? 2 : 1), rows, [&](int begin, int end) {
+        for(int y = begin; y < end; y++)
+        {
+            RGBPixel* top = pixels[y].data();
+            RGBPixel* bottom = pixels[flipY ? height - 1 - y : y].data();
+            if(flipX)
+            {
+                std::reverse(top, top + width);
+                if(bottom != top)
+                {
+                    std::reverse(bottom, bottom + width);
+                }
+            }
+            if(bottom != top)
+            {
+                std::swap_ranges(top, top + width, bottom);
+            }
+        }
+    });
+}
+
+/**
+ * GeometricFilter is the base abstract class for filters that only move pixels
+ * around, without changing them. Any such filter should inherit from
+ * GeometricFilter and override getRemap(int, int) to describe where each
+ * pixel moves. Runs of GeometricFilters can be collapsed into a single pass
+ * with RemapFilter.
+ */
+class GeometricFilter : public ImageFilter {
+public:
+    /**
+     * Gets the remap that this filter applies to an image of the given size.
+     * @param width the width of the source image
+     * @param height the height of the source image
+     * @return the remap from the filtered image to the source image
+     */
+    virtual PixelRemap getRemap(int width, int height) = 0;
+
+    /**
+     * Filters the image by applying its remap.
+     * @param srcImg the base image used in the transformation
+     * @return a filtered version of the image, not the original image.
+     */
+    virtual RGBImage filter(const RGBImage& srcImg) {
+        return remapImage(srcImg, getRemap(srcImg.getWidth(), srcImg.getHeight()));
+    }
+    /**
+     * Filters the image in place when its remap allows it. A remap that
+     * leaves the image unchanged, such as a whole turn, does nothing. One
+     * that cuts out a rectangle makes the image a view of that rectangle, and
+     * one that only reverses the rows or columns, such as a reflection or a
+     * half turn, swaps pixels in place. Anything else, such as a quarter
+     * turn, needs a new image.
+     * @param img the image to filter, which is changed
+     * @return true if the image was filtered, false if it was left alone
+     */
+    virtual bool filterInPlace(RGBImage& img) {
+        int width = img.getWidth();
+        int height = img.getHeight();
+        PixelRemap remap = getRemap(width, height);
+        remap.assertValid(width, height);
+        if(remap.width == 0 || remap.height == 0)
+        {
+            img = RGBImage(remap.width, remap.height);
+            return true;
+        }
+        if(remap.xStepY != 0 || remap.yStepX != 0)
+        {
+            return false;
+        }
+        if(remap.xStepX == 1 && remap.yStepY == 1)
+        {
+            img = img.subImage(remap.x0, remap.y0, remap.width, remap.height);
+            return true;
+        }
+        bool flipX = remap.xStepX == -1 && remap.x0 == width - 1;
+        bool flipY = remap.yStepY == -1 && remap.y0 == height - 1;
+        if(remap.width != width || remap.height != height
+        || !(flipX || (remap.xStepX == 1 && remap.x0 == 0))
+        || !(flipY || (remap.yStepY == 1 && remap.y0 == 0)))
+        {
+            return false;
+        }
+        flipImage(img, flipX, flipY);
+        return true;
+    }
+};
+
+/**
+ * RemapFilter applies a sequence of GeometricFilters as one. The remaps of the
+ * filters are composed, so an image is copied once however many rotations,
+ * reflections and crops there are.
+ */
+class RemapFilter : public GeometricFilter {
+private:
+    /** the filters to apply, in order */
+    std::vector<std::shared_ptr<GeometricFilter> > filters;
+public:
+    /**
+     * Creates a filter that applies all of the given filters in order.
+     * @param filters the filters to collapse, in the order they are applied
+     */
+    RemapFilter(const std::vector<std::shared_ptr<GeometricFilter> >& filters)
+            : filters(filters) { }
+
+    /**
+     * Composes the remaps of every filter. Each filter's remap is checked
+     * against the image it would have been given, so errors are the same as
+     * running the filters one by one.
+     * @param width the width of the source image
+     * @param height the height of the source image
+     * @return the remap from the final image to the source image
+     */
+    virtual PixelRemap getRemap(int width, int height) {
+        PixelRemap remap = PixelRemap::identity(width, height);
+        for(int i = 0; i < filters.size(); i++)
+        {
+            PixelRemap next = filters[i]->getRemap(remap.width, remap.height);
+            next.assertValid(remap.width, remap.height);
+            remap = remap.then(next);
+        }
+        return remap;
+    }
+};
+
+}
@@ -1,17 +1,46 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <thread>
+#include <utility>
 #include <vector>
+#include "BoundedQueue.h"
 #include "Exceptions.h"
-#include "Coloramplifier.h"
+#include "GeometricFilter.h"
+#include "ChannelImage.h"
+#include "ColorAmplifier.h"
+#include "ColorCurve.h"
 #include "ColorInverter.h"
 #include "ColorSplitter.h"
+#include "GammaCorrector.h"
 #include "ImageReflector.h"
+#include "ImageResampler.h"
 #include "ImageRotator.h"
 #include "ImageScaler.h"
 #include "ImageSeparator.h"
 #include "ImageSlicer.h"
+#include "LevelsAdjuster.h"
+#include "MappedBitmap.h"
+#include "PixelFilter.h"
+#include "PixelFormats.h"
+#include "ResultCache.h"
+#include "ScanlineStream.h"
+#include "StageStats.h"
+#include "Trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <glob.h>
+#define IMANIP_HAS_GLOB 1
+#endif
 
 namespace IManip {
 
@@ -21,11 +50,124 @@ const std::string AVAILIBLE_FILTERS =
     "ColorAmplifier:\tca <double> <double> <double>\n"
     "ColorInverter:\tci\n"
     "ColorSplitter:\tcs\n"
+    "GammaCorrector:\tcg <double> <double> <double>\n"
     "ImageCropper:\tic <int> <int> <int> <int>\n"
     "ImageReflector:\tiref\n"
+    "ImageResampler:\tirs <nearest|bilinear|area|lanczos> <double>\n"
     "ImageRotator:\tir <int>\n"
     "ImageScaler:\tis <int>\n"
-    "ImageSlicer:\tisl <int> <int>\n";
+    "ImageSlicer:\tisl <int> <int>\n"
+    "LevelsAdjuster:\tcl <int> <int>\n";
+
+/** A help message displaying the options that can come before the filenames */
+const std::string AVAILIBLE_OPTIONS =
+    "Known options:\n"
+    "--mmap\tmap the input file instead of loading it\n"
+    "--stream\tfilter a row at a time, for row-local filters only (ca cg ci cl ic iref is)\n"
+    "--gray\tload, filter and save the image as 8-bit gray, a third of the memory,\n"
+    "\tfor filters with gray kernels only (ca cg ci cl ic iref ir). A first cs splits\n"
+    "\tthe input into red, green and blue planes, which are filtered and saved as gray\n"
+    "--threads <int>\tthe number of threads to filter with, one per core by default\n"
+    "--stats [table|json]\tprint the time, pixels, allocations and peak memory of each stage\n"
+    "--trace <file>\twrite a Chrome trace of every load, filter, separator and save to the file\n"
+    "--cache <dir>\treuse results, and results of the first few commands, kept in the directory\n"
+    "--cache-limit <int>\tthe most megabytes the cache keeps, 1024 by default\n"
+    "--batch <glob|manifest|->\tfilter every input matched by the glob or listed one per line\n"
+    "\tin the manifest file or on stdin; give an output directory instead of the two filenames\n";
+
+/**
+ * Options that change how parseAndRun runs the image manipulations, rather
+ * than which manipulations are run.
+ */
+struct RunOptions {
+    /** whether the input file should be memory mapped instead of loaded */
+    bool mapInput;
+    /** whether the image should be streamed through the filters a row at a time */
+    bool streamRows;
+    /** whether the image should be loaded, filtered and saved as 8-bit gray */
+    bool grayPixels;
+    /** the number of threads to filter with, or 0 to use the default */
+    int threadCount;
+    /** the glob or manifest listing the inputs of a batch, or empty to filter one file */
+    std::string batchSource;
+    /** how to print the stats of each stage, "table" or "json", or empty to not record them */
+    std::string statsFormat;
+    /** the file to write a Chrome trace of the run to, or empty to not trace it */
+    std::string traceFilename;
+    /** the directory results are cached in, or empty to not cache them */
+    std::string cacheDirectory;
+    /** the most bytes the cache keeps */
+    size_t cacheLimit;
+
+    /**
+     * Creates the default options.
+     */
+    RunOptions() : mapInput(false), streamRows(false), grayPixels(false), threadCount(0), cacheLimit(CACHE_DEFAULT_LIMIT) { }
+};
+
+/**
+ * ImageCommand is a single image manipulation parsed from the command line.
+ * It holds either a filter or a separator, along with the text of the command
+ * that it was parsed from.
+ */
+class ImageCommand {
+private:
+    /** the command and its arguments, separated by spaces */
+    std::string text;
+    /** the filter run by this command, if it is a filter */
+    std::shared_ptr<ImageFilter> filter;
+    /** the separator run by this command, if it is a separator */
+    std::shared_ptr<ImageSeparator> separator;
+public:
+    /**
+     * Creates a command that runs a filter.
+     * @param text the command and its arguments
+     * @param filter the heap allocated filter, which the command takes ownership of
+     */
+    ImageCommand(std::string text, ImageFilter* filter) : text(text), filter(filter) { }
+    /**
+     * Creates a command that runs a separator.
+     * @param text the command and its arguments
+     * @param separator the heap allocated separator, which the command takes ownership of
+     */
+    ImageCommand(std::string text, ImageSeparator* separator) : text(text), separator(separator) { }
+
+    /**
+     * Gets the text of the command, as it was given on the command line.
+     * @return the command and its arguments, separated by spaces
+     */
+    std::string getText() const {
+        return text;
+    }
+    /**
+     * Gets the filter run by this command.
+     * @return the filter, or null if this command runs a separator
+     */
+    ImageFilter* getFilter() const {
+        return filter.get();
+    }
+    /**
+     * Gets the filter run by this command if it is a pointwise filter.
+     * @return the filter, or null if this command doesn't run a PixelFilter
+     */
+    std::shared_ptr<PixelFilter> getPixelFilter() const {
+        return std::dynamic_pointer_cast<PixelFilter>(filter);
+    }
+    /**
+     * Gets the filter run by this command if it only moves pixels around.
+     * @return the filter, or null if this command doesn't run a GeometricFilter
+     */
+    std::shared_ptr<GeometricFilter> getGeometricFilter() const {
+        return std::dynamic_pointer_cast<GeometricFilter>(filter);
+    }
+    /**
+     * Gets the separator run by this command.
+     * @return the separator, or null if this command runs a filter
+     */
+    ImageSeparator* getSeparator() const {
+        return separator.get();
+    }
+};
 
 /**
  * Checks that the required number of arguments are remaining in the command line arguments.
@@ -63,7 +205,11 @@ void assertArgCount(int argCount, std::string message, int index, int argc, cons
  */
 ColorAmplifier createColorAmplifier(int& index, int argc, const char** argv) {
     assertArgCount(3, "ColorAmplifier requires <double> <double> <double>", index, argc, argv);
-    return ColorAmplifier(atof(argv[index++]), atof(argv[index++]), atof(argv[index++]));
+    // the arguments are read one statement at a time so that they are used in order
+    double redRatio = atof(argv[index++]);
+    double greenRatio = atof(argv[index++]);
+    double blueRatio = atof(argv[index++]);
+    return ColorAmplifier(redRatio, greenRatio, blueRatio);
 }
 /**
  * Constructs a ColorInverter based on the remaining command line arguments.
@@ -87,6 +233,35 @@ ColorInverter createColorInverter(int& index, int argc, const char** argv) {
 ColorSplitter createColorSplitter(int& index, int argc, const char** argv) {
     return ColorSplitter();
 }
+/**
+ * Constructs a GammaCorrector based on the remaining command line arguments.
+ * It will use three arguments, double double double.
+ * @param index the index of the next argument to be used
+ * @param argc the total number of arguments
+ * @param argv the array of string literal arguments
+ * @return the constructed GammaCorrector
+ */
+GammaCorrector createGammaCorrector(int& index, int argc, const char** argv) {
+    assertArgCount(3, "GammaCorrector requires <double> <double> <double>", index, argc, argv);
+    double redGamma = atof(argv[index++]);
+    double greenGamma = atof(argv[index++]);
+    double blueGamma = atof(argv[index++]);
+    return GammaCorrector(redGamma, greenGamma, blueGamma);
+}
+/**
+ * Constructs a LevelsAdjuster based on the remaining command line arguments.
+ * It will use 2 arguments, int int
+ * @param index the index of the next argument to be used
+ * @param argc the total number of arguments
+ * @param argv the array of string literal arguments
+ * @return the constructed LevelsAdjuster
+ */
+LevelsAdjuster createLevelsAdjuster(int& index, int argc, const char** argv) {
+    assertArgCount(2, "LevelsAdjuster requires <int> <int>", index, argc, argv);
+    int black = atoi(argv[index++]);
+    int white = atoi(argv[index++]);
+    return LevelsAdjuster(black, white);
+}
 /**
  * Constructs an ImageCropper based on the remaining command line arguments.
  * It will use 4 arguments, int int int int
@@ -97,7 +272,11 @@ ColorSplitter createColorSplitter(int& index, int argc, const char** argv) {
  */
 ImageCropper createImageCropper(int& index, int argc, const char** argv) {
     assertArgCount(4, "ImageSlicer requires <int> <int> <int> <int>", index, argc, argv);
-    return ImageCropper(atoi(argv[index++]),atoi(argv[index++]),atoi(argv[index++]),atoi(argv[index++]));
+    int x1 = atoi(argv[index++]);
+    int y1 = atoi(argv[index++]);
+    int x2 = atoi(argv[index++]);
+    int y2 = atoi(argv[index++]);
+    return ImageCropper(x1, y1, x2, y2);
 }
 /**
  * Constructs an ImageReflector based on the remaining command line arguments.
@@ -110,6 +289,20 @@ ImageCropper createImageCropper(int& index, int argc, const char** argv) {
 ImageReflector createImageReflector(int& index, int argc, const char** argv) {
     return ImageReflector();
 }
+/**
+ * Constructs an ImageResampler based on the remaining command line arguments.
+ * It will use 2 arguments, mode double
+ * @param index the index of the next argument to be used
+ * @param argc the total number of arguments
+ * @param argv the array of string literal arguments
+ * @return the constructed ImageResampler
+ */
+ImageResampler createImageResampler(int& index, int argc, const char** argv) {
+    assertArgCount(2, "ImageResampler requires <nearest|bilinear|area|lanczos> <double>", index, argc, argv);
+    ResampleMode mode = ImageResampler::parseMode(argv[index++]);
+    double factor = atof(argv[index++]);
+    return ImageResampler(mode, factor);
+}
 /**
  * Constructs an ImageRotator based on the remaining command line arguments.
  * It will use 1 argument, int
@@ -144,87 +337,1146 @@ ImageScaler createImageScaler(int& index, int argc, const char** argv) {
  */
 ImageSlicer createImageSlicer(int& index, int argc, const char** argv) {
     assertArgCount(2, "ImageSlicer requires <int> <int>", index, argc, argv);
-    return ImageSlicer(atoi(argv[index++]), atoi(argv[index++]));
+    int rows = atoi(argv[index++]);
+    int columns = atoi(argv[index++]);
+    return ImageSlicer(rows, columns);
 }
 
 /**
- * Parses a set of string literal arguments and runs the resulting set of
- * Image Manipulations.
- * @param argc the total number of arguments 
+ * Parses the options at the start of the command line arguments. Options
+ * start with "--", and parsing stops at the first argument that doesn't.
+ * @param index the index of the next argument to be used
+ * @param argc the total number of arguments
  * @param argv the array of string literal arguments
+ * @return the parsed options
+ * @throws IllegalArgumentException if an option is not known, or its argument
+ *         is missing or out of range
  */
-void parseAndRun(int argc, const char** argv) {
-    if(argc < 2)
+RunOptions parseOptions(int& index, int argc, const char** argv) {
+    RunOptions options;
+    while(index < argc && std::string(argv[index]).compare(0, 2, "--") == 0)
     {
-        throw IllegalArgumentException("Format is: <input_filename> <output_filename> [filters...]");
-    }
-    std::string inputFilename = argv[0];
-    std::string outputFilename = argv[1];
-    
-    int index = 2;
-    std::vector<RGBImage> images;
-    images.push_back(RGBImage(inputFilename)); // add the seed input image
-    
-    // run through the commands
-    while(index < argc) {
-        std::string command = argv[index++];
-        if(command == "ca")
+        std::string option = argv[index++];
+        if(option == "--mmap")
+        {
+            options.mapInput = true;
+        }
+        else if(option == "--stream")
+        {
+            options.streamRows = true;
+        }
+        else if(option == "--gray")
+        {
+            options.grayPixels = true;
+        }
+        else if(option == "--threads")
+        {
+            assertArgCount(1, "--threads requires <int>", index, argc, argv);
+            options.threadCount = atoi(argv[index++]);
+            if(options.threadCount < 1)
+            {
+                throw IllegalArgumentException("--threads must be at least 1");
+            }
+        }
+        else if(option == "--batch")
+        {
+            assertArgCount(1, "--batch requires <glob|manifest|->", index, argc, argv);
+            options.batchSource = argv[index++];
+        }
+        else if(option == "--cache")
+        {
+            assertArgCount(1, "--cache requires <dir>", index, argc, argv);
+            options.cacheDirectory = argv[index++];
+        }
+        else if(option == "--cache-limit")
+        {
+            assertArgCount(1, "--cache-limit requires <int>", index, argc, argv);
+            int megabytes = atoi(argv[index++]);
+            if(megabytes < 1)
+            {
+                throw IllegalArgumentException("--cache-limit must be at least 1");
+            }
+            options.cacheLimit = (size_t)megabytes << 20;
+        }
+        else if(option == "--trace")
         {
-            ColorAmplifier colorAmplifier = createColorAmplifier(index, argc, argv);
-            images = colorAmplifier.applyOverVector(images);
+            assertArgCount(1, "--trace requires <file>", index, argc, argv);
+            options.traceFilename = argv[index++];
         }
-        else if(command == "ci")
+        else if(option == "--stats")
         {
-            ColorInverter colorInverter = createColorInverter(index, argc, argv);
-            images = colorInverter.applyOverVector(images);
+#ifdef IMANIP_STATS
+            options.statsFormat = "table";
+            if(index < argc && (std::string(argv[index]) == "table" || std::string(argv[index]) == "json"))
+            {
+                options.statsFormat = argv[index++];
+            }
+#else
+            throw IllegalArgumentException("--stats is not available, this build defines IMANIP_NO_STATS");
+#endif
         }
-        else if(command == "cs")
+        else
         {
-            ColorSplitter colorSplitter = createColorSplitter(index, argc, argv);
-            images = colorSplitter.applyOverVector(images);
+            std::stringstream stream;
+            stream << "Unknown option: \"" << option << "\"\n" << AVAILIBLE_OPTIONS << std::endl;
+            throw IllegalArgumentException(stream.str());
         }
-        else if(command == "ic")
+    }
+    return options;
+}
+
+/**
+ * Parses a single command and its arguments from the command line arguments.
+ * @param index the index of the command, moved past its arguments
+ * @param argc the total number of arguments
+ * @param argv the array of string literal arguments
+ * @return the parsed command
+ * @throws IllegalArgumentException if the command is unknown, or its arguments are missing
+ */
+ImageCommand parseCommand(int& index, int argc, const char** argv) {
+    int start = index;
+    std::string command = argv[index++];
+    ImageFilter* filter = 0;
+    ImageSeparator* separator = 0;
+    if(command == "ca")
+    {
+        filter = new ColorAmplifier(createColorAmplifier(index, argc, argv));
+    }
+    else if(command == "cg")
+    {
+        filter = new GammaCorrector(createGammaCorrector(index, argc, argv));
+    }
+    else if(command == "ci")
+    {
+        filter = new ColorInverter(createColorInverter(index, argc, argv));
+    }
+    else if(command == "cl")
+    {
+        filter = new LevelsAdjuster(createLevelsAdjuster(index, argc, argv));
+    }
+    else if(command == "cs")
+    {
+        separator = new ColorSplitter(createColorSplitter(index, argc, argv));
+    }
+    else if(command == "ic")
+    {
+        filter = new ImageCropper(createImageCropper(index, argc, argv));
+    }
+    else if(command == "ir")
+    {
+        filter = new ImageRotator(createImageRotator(index, argc, argv));
+    }
+    else if(command == "iref")
+    {
+        filter = new ImageReflector(createImageReflector(index, argc, argv));
+    }
+    else if(command == "irs")
+    {
+        filter = new ImageResampler(createImageResampler(index, argc, argv));
+    }
+    else if(command == "is")
+    {
+        filter = new ImageScaler(createImageScaler(index, argc, argv));
+    }
+    else if(command == "isl")
+    {
+        separator = new ImageSlicer(createImageSlicer(index, argc, argv));
+    }
+    else
+    {
+        std::stringstream stream;
+        stream << "Unknown filter name: \"" << command << "\"\n" << AVAILIBLE_FILTERS << std::endl;
+        throw IllegalArgumentException(stream.str());
+    }
+
+    std::string text = command;
+    for(int i = start + 1; i < index; i++)
+    {
+        text += std::string(" ") + argv[i];
+    }
+    if(filter)
+    {
+        return ImageCommand(text, filter);
+    }
+    return ImageCommand(text, separator);
+}
+/**
+ * Parses all of the remaining command line arguments as commands.
+ * @param index the index of the first command, moved to the end of the arguments
+ * @param argc the total number of arguments
+ * @param argv the array of string literal arguments
+ * @return the parsed commands, in order
+ * @throws IllegalArgumentException if a command is unknown, or its arguments are missing
+ */
+std::vector<ImageCommand> parseCommands(int& index, int argc, const char** argv) {
+    std::vector<ImageCommand> commands;
+    while(index < argc)
+    {
+        commands.push_back(parseCommand(index, argc, argv));
+    }
+    return commands;
+}
+
+/**
+ * Fuses every run of consecutive pointwise filters in the commands into a
+ * single FusedPixelFilter, so that the run takes one pass over each image
+ * instead of one pass per filter.
+ * @param commands the commands to fuse
+ * @return the commands with every run of PixelFilters replaced by one command
+ */
+std::vector<ImageCommand> fuseCommands(const std::vector<ImageCommand>& commands) {
+    std::vector<ImageCommand> fusedCommands;
+    int i = 0;
+    while(i < commands.size())
+    {
+        // find the end of the run of pixel filters starting here
+        int end = i;
+        while(end < commands.size() && commands[end].getPixelFilter())
         {
-            ImageCropper imageCropper = createImageCropper(index, argc, argv);
-            images = imageCropper.applyOverVector(images);
+            end++;
         }
-        else if(command == "ir")
+
+        if(end - i < 2)
         {
-            ImageRotator imageRotator = createImageRotator(index, argc, argv);
-            images = imageRotator.applyOverVector(images);
+            // nothing to fuse
+            fusedCommands.push_back(commands[i]);
+            i++;
         }
-        else if(command == "iref")
+        else
         {
-            ImageReflector imageReflector = createImageReflector(index, argc, argv);
-            images = imageReflector.applyOverVector(images);
+            std::vector<std::shared_ptr<PixelFilter> > filters;
+            std::string text = commands[i].getText();
+            filters.push_back(commands[i].getPixelFilter());
+            for(int j = i + 1; j < end; j++)
+            {
+                text += " " + commands[j].getText();
+                filters.push_back(commands[j].getPixelFilter());
+            }
+            fusedCommands.push_back(ImageCommand(text, new FusedPixelFilter(filters)));
+            i = end;
         }
-        else if(command == "is")
+    }
+    return fusedCommands;
+}
+
+/**
+ * Collapses every run of consecutive geometric filters in the commands into a
+ * single RemapFilter, so that the run copies each image once instead of once
+ * per filter.
+ * @param commands the commands to collapse
+ * @return the commands with every run of GeometricFilters replaced by one command
+ */
+std::vector<ImageCommand> collapseRemaps(const std::vector<ImageCommand>& commands) {
+    std::vector<ImageCommand> collapsedCommands;
+    int i = 0;
+    while(i < commands.size())
+    {
+        // find the end of the run of geometric filters starting here
+        int end = i;
+        while(end < commands.size() && commands[end].getGeometricFilter())
         {
-            ImageScaler imageScaler = createImageScaler(index, argc, argv);
-            images = imageScaler.applyOverVector(images);
+            end++;
         }
-        else if(command == "isl")
+
+        if(end - i < 2)
         {
-            ImageSlicer imageSlicer = createImageSlicer(index, argc, argv);
-            images = imageSlicer.applyOverVector(images);
+            // nothing to collapse
+            collapsedCommands.push_back(commands[i]);
+            i++;
         }
         else
+        {
+            std::vector<std::shared_ptr<GeometricFilter> > filters;
+            std::string text = commands[i].getText();
+            filters.push_back(commands[i].getGeometricFilter());
+            for(int j = i + 1; j < end; j++)
+            {
+                text += " " + commands[j].getText();
+                filters.push_back(commands[j].getGeometricFilter());
+            }
+            collapsedCommands.push_back(ImageCommand(text, new RemapFilter(filters)));
+            i = end;
+        }
+    }
+    return collapsedCommands;
+}
+
+/**
+ * Gets the row-local filters that the commands run, to stream an image
+ * through.
+ * @param commands the commands to run
+ * @return the filter of each command, in order
+ * @throws IllegalArgumentException if a command cannot be streamed
+ */
+std::vector<ScanlineFilter*> getScanlineFilters(const std::vector<ImageCommand>& commands) {
+    std::vector<ScanlineFilter*> filters;
+    for(int i = 0; i < commands.size(); i++)
+    {
+        ScanlineFilter* filter = dynamic_cast<ScanlineFilter*>(commands[i].getFilter());
+        if(!filter)
+        {
+            std::stringstream stream;
+            stream << "\"" << commands[i].getText() << "\" is not row-local and cannot be streamed";
+            throw IllegalArgumentException(stream.str());
+        }
+        filters.push_back(filter);
+    }
+    return filters;
+}
+/**
+ * Streams the input file through the commands into the output file a row at
+ * a time. Every command must be a row-local filter.
+ * @param inputFilename the name of the bitmap file to read
+ * @param outputFilename the name of the bitmap file to write
+ * @param commands the commands to run
+ * @throws IllegalArgumentException if a command cannot be streamed
+ */
+void streamCommands(std::string inputFilename, std::string outputFilename,
+                    const std::vector<ImageCommand>& commands) {
+    streamFilters(inputFilename, outputFilename, getScanlineFilters(commands));
+}
+
+/**
+ * Applies a filter to the images being manipulated. If the input is still
+ * mapped and hasn't been decoded yet, the filter reads straight from it.
+ * Otherwise the images are filtered in place where the filter can.
+ * @param filter the filter to apply
+ * @param images the images being manipulated
+ * @param mappedInput the mapped input file, released once it has been used
+ */
+void applyFilter(ImageFilter& filter, std::vector<RGBImage>& images,
+                 std::unique_ptr<MappedBitmap>& mappedInput) {
+    if(mappedInput)
+    {
+        images.push_back(filter.filterMapped(*mappedInput));
+        mappedInput.reset();
+    }
+    else
+    {
+        images = filter.applyOverVector(std::move(images));
+    }
+}
+/**
+ * Applies a separator to the images being manipulated. If the input is still
+ * mapped, it is decoded first.
+ * @param separator the separator to apply
+ * @param images the images being manipulated
+ * @param mappedInput the mapped input file, released once it has been used
+ */
+void applySeparator(ImageSeparator& separator, std::vector<RGBImage>& images,
+                    std::unique_ptr<MappedBitmap>& mappedInput) {
+    if(mappedInput)
+    {
+        images.push_back(mappedInput->decode());
+        mappedInput.reset();
+    }
+    images = separator.applyOverVector(std::move(images));
+}
+
+/**
+ * Counts the pixels of the images being manipulated, in color or gray.
+ * @param images the images being manipulated
+ * @param mappedInput the mapped input file if it hasn't been decoded yet
+ * @return the total number of pixels
+ */
+template <class Image>
+long long countPixels(const std::vector<Image>& images, const std::unique_ptr<MappedBitmap>& mappedInput) {
+    long long pixels = mappedInput ? (long long)mappedInput->getWidth() * mappedInput->getHeight() : 0;
+    for(int i = 0; i < images.size(); i++)
+    {
+        pixels += (long long)images[i].getWidth() * images[i].getHeight();
+    }
+    return pixels;
+}
+
+/**
+ * Runs a single command over the images being manipulated.
+ * @param command the command to run
+ * @param images the images being manipulated, replaced by the results
+ * @param mappedInput the mapped input file if it hasn't been decoded yet,
+ *        released once it has been used
+ * @param stats records the command as a stage, or null
+ */
+void runCommand(const ImageCommand& command, std::vector<RGBImage>& images,
+                std::unique_ptr<MappedBitmap>& mappedInput, StatsRecorder* stats = 0) {
+    StageTimer timer(stats, command.getText());
+    TraceScope scope("command", command.getText().c_str());
+    if(mappedInput)
+    {
+        scope.setSize(mappedInput->getWidth(), mappedInput->getHeight());
+    }
+    else if(!images.empty())
+    {
+        scope.setSize(images[0].getWidth(), images[0].getHeight());
+    }
+    long long pixels = stats ? countPixels(images, mappedInput) : 0;
+    if(command.getFilter())
+    {
+        applyFilter(*command.getFilter(), images, mappedInput);
+    }
+    else
+    {
+        applySeparator(*command.getSeparator(), images, mappedInput);
+    }
+    timer.finish(pixels);
+}
+/**
+ * Decodes the mapped input file, if it hasn't been decoded yet.
+ * @param images the images being manipulated, given the decoded input
+ * @param mappedInput the mapped input file, released once it is decoded
+ * @param stats records the decode as a stage, or null
+ */
+void decodeMappedInput(std::vector<RGBImage>& images, std::unique_ptr<MappedBitmap>& mappedInput,
+                       StatsRecorder* stats = 0) {
+    if(mappedInput)
+    {
+        StageTimer timer(stats, "decode");
+        TraceScope scope("io", "decode", mappedInput->getWidth(), mappedInput->getHeight());
+        images.push_back(mappedInput->decode());
+        mappedInput.reset();
+        timer.finish(countPixels(images, mappedInput));
+    }
+}
+/**
+ * Runs the commands over the images being manipulated, in order.
+ * @param commands the commands to run
+ * @param images the images being manipulated, replaced by the results
+ * @param mappedInput the mapped input file if it hasn't been decoded yet,
+ *        released once it has been used
+ * @param stats records each command as a stage, or null
+ */
+void runCommands(const std::vector<ImageCommand>& commands, std::vector<RGBImage>& images,
+                 std::unique_ptr<MappedBitmap>& mappedInput, StatsRecorder* stats = 0) {
+    for(int i = 0; i < commands.size(); i++)
+    {
+        runCommand(commands[i], images, mappedInput, stats);
+    }
+    // nothing used the mapped input, so decode it to be saved as is
+    decodeMappedInput(images, mappedInput, stats);
+}
+
+/**
+ * Checks that every command can be run on gray images: the geometric filters,
+ * which move whole pixels of any format, and the color curves and inverter,
+ * which have gray kernels. A ColorSplitter may come first, to split the color
+ * input into gray planes. Every other command works on color.
+ * @param commands the commands to run
+ * @throws IllegalArgumentException if a command cannot be run on gray images
+ */
+void assertGrayCommands(const std::vector<ImageCommand>& commands) {
+    for(int i = 0; i < commands.size(); i++)
+    {
+        ImageFilter* filter = commands[i].getFilter();
+        if(i == 0 && dynamic_cast<ColorSplitter*>(commands[i].getSeparator()))
+        {
+            continue;
+        }
+        if(!commands[i].getGeometricFilter() && !dynamic_cast<ColorCurve*>(filter)
+        && !dynamic_cast<ColorInverter*>(filter))
         {
             std::stringstream stream;
-            stream << "Unknown filter name: \"" << command << "\"\n" << AVAILIBLE_FILTERS << std::endl;
+            stream << "\"" << commands[i].getText() << "\" cannot be run on a gray image";
+            if(dynamic_cast<ColorSplitter*>(commands[i].getSeparator()))
+            {
+                stream << ", only on the color input as the first command";
+            }
             throw IllegalArgumentException(stream.str());
         }
     }
+}
+/**
+ * Runs a single command over gray images, with the gray kernels. If the input
+ * is still mapped, a ColorSplitter splits it straight into its planes, and any
+ * other command decodes it to gray first.
+ * @param command the command to run, which must pass assertGrayCommands
+ * @param images the images being manipulated, replaced by the results
+ * @param mappedInput the mapped input file if it hasn't been decoded yet,
+ *        released once it has been used
+ * @param stats records the command as a stage, or null
+ */
+void runGrayCommand(const ImageCommand& command, std::vector<ChannelImage>& images,
+                    std::unique_ptr<MappedBitmap>& mappedInput, StatsRecorder* stats = 0) {
+    StageTimer timer(stats, command.getText());
+    TraceScope scope("command", command.getText().c_str());
+    if(mappedInput)
+    {
+        scope.setSize(mappedInput->getWidth(), mappedInput->getHeight());
+    }
+    else if(!images.empty())
+    {
+        scope.setSize(images[0].getWidth(), images[0].getHeight());
+    }
+    long long pixels = stats ? countPixels(images, mappedInput) : 0;
+    ColorSplitter* splitter = dynamic_cast<ColorSplitter*>(command.getSeparator());
+    if(mappedInput)
+    {
+        if(splitter)
+        {
+            images = splitter->splitChannels(*mappedInput);
+        }
+        else
+        {
+            images.push_back(decodePixelImage<Gray8>(*mappedInput));
+        }
+        mappedInput.reset();
+    }
+    std::shared_ptr<GeometricFilter> geometricFilter = command.getGeometricFilter();
+    ColorCurve* curve = dynamic_cast<ColorCurve*>(command.getFilter());
+    for(int i = 0; i < images.size() && !splitter; i++)
+    {
+        if(geometricFilter)
+        {
+            images[i] = remapPixelImage(images[i], geometricFilter->getRemap(images[i].getWidth(), images[i].getHeight()));
+        }
+        else if(curve)
+        {
+            curveImage(images[i], *curve);
+        }
+        else
+        {
+            invertImage(images[i]);
+        }
+    }
+    timer.finish(pixels);
+}
+/**
+ * Runs the commands over gray images, in order. Pointwise filters must not be
+ * fused first: a gray curve turns its result back to gray, so two curves in a
+ * row on a gray image aren't the same as their composition.
+ * @param commands the commands to run, which must pass assertGrayCommands
+ * @param images the images being manipulated, replaced by the results
+ * @param mappedInput the mapped input file if it hasn't been decoded yet,
+ *        released once it has been used
+ * @param stats records each command as a stage, or null
+ */
+void runGrayCommands(const std::vector<ImageCommand>& commands, std::vector<ChannelImage>& images,
+                     std::unique_ptr<MappedBitmap>& mappedInput, StatsRecorder* stats = 0) {
+    for(int i = 0; i < commands.size(); i++)
+    {
+        runGrayCommand(commands[i], images, mappedInput, stats);
+    }
+    // nothing used the mapped input, so decode it to be saved as is
+    if(mappedInput)
+    {
+        StageTimer timer(stats, "decode");
+        TraceScope scope("io", "decode", mappedInput->getWidth(), mappedInput->getHeight());
+        images.push_back(decodePixelImage<Gray8>(*mappedInput));
+        mappedInput.reset();
+        timer.finish(countPixels(images, mappedInput));
+    }
+}
+
+/**
+ * Rewrites the text of commands so that arguments written differently but
+ * read the same give the same text. Numbers lose a leading +, leading zeros
+ * and trailing zeros after the point, and ".5" becomes "0.5". Each of these
+ * keeps the value that both atoi and atof read, so commands with the same
+ * canonical text always do the same thing.
+ * @param text the commands and their arguments, separated by spaces
+ * @return the canonical text of the commands
+ */
+std::string getCanonicalText(const std::string& text) {
+    std::stringstream tokens(text);
+    std::string token, canonical;
+    while(tokens >> token)
+    {
+        size_t digits = token.find_first_not_of("+-");
+        size_t point = token.find('.');
+        bool number = digits <= 1 && token.find_first_not_of("0123456789.", digits) == std::string::npos
+                      && token.find_first_of("0123456789") != std::string::npos
+                      && (point == std::string::npos || token.find('.', point + 1) == std::string::npos);
+        if(number)
+        {
+            std::string whole = token.substr(digits, point == std::string::npos ? std::string::npos : point - digits);
+            std::string fraction = point == std::string::npos ? "" : token.substr(point + 1);
+            whole.erase(0, std::min(whole.find_first_not_of('0'), whole.size()));
+            fraction.erase(fraction.find_last_not_of('0') + 1);
+            token = (token[0] == '-' ? "-" : "") + (whole.empty() ? "0" : whole)
+                    + (fraction.empty() ? "" : "." + fraction);
+        }
+        canonical += (canonical.empty() ? "" : " ") + token;
+    }
+    return canonical;
+}
+/**
+ * Runs the commands over the images being manipulated, reusing results kept
+ * in a cache. Entries are keyed by the input's pixels and the canonical text
+ * of the commands run on it so far. The text of a fused or collapsed command
+ * is that of the commands it replaced, so the same prefix has the same key
+ * however it was fused. Prefixes can only be kept and resumed from at the
+ * boundaries of the commands as they are run, though, so a run whose
+ * commands fuse differently only shares the prefixes ending where both runs
+ * have a boundary. The run resumes from the longest cached prefix of its
+ * commands. The result is kept, along with the images after any prefix that
+ * took a while to work out since the last one kept.
+ * @param cache the cache to use
+ * @param commands the commands to run
+ * @param images the images being manipulated, replaced by the results
+ * @param mappedInput the mapped input file if it hasn't been decoded yet.
+ *        It is hashed without being decoded, so that on a miss the first
+ *        command still reads straight from it. It is released on a hit.
+ * @param stats records each command and cache access as a stage, or null
+ */
+void runCachedCommands(ResultCache& cache, const std::vector<ImageCommand>& commands,
+                       std::vector<RGBImage>& images, std::unique_ptr<MappedBitmap>& mappedInput,
+                       StatsRecorder* stats = 0) {
+    if(commands.empty())
+    {
+        decodeMappedInput(images, mappedInput, stats);
+        return;
+    }
+    uint64_t inputHash = hashBytes(&CACHE_VERSION, sizeof(CACHE_VERSION), 0);
+    if(mappedInput)
+    {
+        uint64_t imageHash = hashImage(*mappedInput);
+        inputHash = hashBytes(&imageHash, sizeof(imageHash), inputHash);
+    }
+    for(int i = 0; i < images.size(); i++)
+    {
+        uint64_t imageHash = hashImage(images[i]);
+        inputHash = hashBytes(&imageHash, sizeof(imageHash), inputHash);
+    }
+    std::vector<CacheKey> keys;
+    std::string prefixText;
+    for(int i = 0; i < commands.size(); i++)
+    {
+        prefixText += (i > 0 ? " " : "") + getCanonicalText(commands[i].getText());
+        keys.push_back(CacheKey(inputHash, prefixText));
+    }
+
+    int cachedCount = 0;
+    {
+        StageTimer timer(stats, "cache load");
+        TraceScope scope("io", "cache load");
+        for(int i = commands.size(); i > 0 && cachedCount == 0; i--)
+        {
+            if(cache.load(keys[i - 1], images))
+            {
+                cachedCount = i;
+                mappedInput.reset();
+            }
+        }
+        timer.finish(cachedCount > 0 ? countPixels(images, mappedInput) : 0);
+    }
+
+    double uncachedSeconds = 0;
+    for(int i = cachedCount; i < commands.size(); i++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        runCommand(commands[i], images, mappedInput, stats);
+        uncachedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(i == commands.size() - 1 || uncachedSeconds >= CACHE_PREFIX_SECONDS)
+        {
+            StageTimer timer(stats, "cache store");
+            TraceScope scope("io", "cache store");
+            cache.store(keys[i], images);
+            timer.finish(countPixels(images, mappedInput));
+            uncachedSeconds = 0;
+        }
+    }
+}
+/**
+ * Saves the results of running the commands. A single image is saved to the
+ * output filename, and several are numbered.
+ * @param outputFilename the name of the bitmap file to write
+ * @param images the images to save
+ * @param stats records the encoding of each file as a stage, or null
+ * @throws FileException if a file cannot be written
+ */
+void saveResults(std::string outputFilename, const std::vector<RGBImage>& images,
+                 StatsRecorder* stats = 0) {
+    for(int i = 0; i < images.size(); i++)
+    {
+        std::string filename = images.size() == 1 ? outputFilename : getNumberedFilename(outputFilename, i);
+        StageTimer timer(stats, "encode", filename);
+        TraceScope scope("io", ("encode " + filename).c_str(), images[i].getWidth(), images[i].getHeight());
+        saveImage(filename, images[i]);
+        timer.finish((long long)images[i].getWidth() * images[i].getHeight());
+    }
+}
+/**
+ * Saves the gray results of running the commands, as 24-bit bitmaps. A single
+ * image is saved to the output filename, and several are numbered.
+ * @param outputFilename the name of the bitmap file to write
+ * @param images the images to save
+ * @param stats records the encoding of each file as a stage, or null
+ * @throws FileException if a file cannot be written
+ */
+void saveResults(std::string outputFilename, const std::vector<ChannelImage>& images,
+                 StatsRecorder* stats = 0) {
+    for(int i = 0; i < images.size(); i++)
+    {
+        std::string filename = images.size() == 1 ? outputFilename : getNumberedFilename(outputFilename, i);
+        StageTimer timer(stats, "encode", filename);
+        TraceScope scope("io", ("encode " + filename).c_str(), images[i].getWidth(), images[i].getHeight());
+        savePixelImage(filename, images[i]);
+        timer.finish((long long)images[i].getWidth() * images[i].getHeight());
+    }
+}
+
+/**
+ * Loads the input of a run, or maps it to be decoded by the first command
+ * that reads it.
+ * @param inputFilename the name of the bitmap file to read
+ * @param mapInput whether to map the file instead of loading it
+ * @param images the images being manipulated, given the loaded input
+ * @param mappedInput set to the mapped input file if it is mapped
+ * @param stats records the load or map as a stage, or null
+ * @throws FileException if the file cannot be read
+ */
+void loadInput(const std::string& inputFilename, bool mapInput, std::vector<RGBImage>& images,
+               std::unique_ptr<MappedBitmap>& mappedInput, StatsRecorder* stats = 0) {
+    StageTimer timer(stats, mapInput ? "map" : "decode", inputFilename);
+    TraceScope scope("io", ((mapInput ? "map " : "decode ") + inputFilename).c_str());
+    if(mapInput)
+    {
+        // the first filter reads the seed input image straight from the file
+        mappedInput.reset(new MappedBitmap(inputFilename));
+        scope.setSize(mappedInput->getWidth(), mappedInput->getHeight());
+    }
+    else
+    {
+        images.push_back(RGBImage(inputFilename)); // add the seed input image
+        scope.setSize(images.back().getWidth(), images.back().getHeight());
+    }
+    timer.finish(countPixels(images, mappedInput));
+}
+/**
+ * Maps the input of a gray run, to be decoded straight to gray, or split into
+ * gray planes, by the first command that reads it. No color copy of the input
+ * is ever held.
+ * @param inputFilename the name of the bitmap file to read
+ * @param mappedInput set to the mapped input file
+ * @param stats records the map as a stage, or null
+ * @throws FileException if the file cannot be read
+ */
+void loadGrayInput(const std::string& inputFilename, std::unique_ptr<MappedBitmap>& mappedInput,
+                   StatsRecorder* stats = 0) {
+    StageTimer timer(stats, "map", inputFilename);
+    TraceScope scope("io", ("map " + inputFilename).c_str());
+    mappedInput.reset(new MappedBitmap(inputFilename));
+    scope.setSize(mappedInput->getWidth(), mappedInput->getHeight());
+    timer.finish((long long)mappedInput->getWidth() * mappedInput->getHeight());
+}
+
+/**
+ * Lists the inputs of a batch. A source containing *, ? or [ is a glob
+ * pattern, "-" means a list on standard input, and anything else is a
+ * manifest file. Lists have one filename per line, and blank lines and lines
+ * starting with # are skipped.
+ * @param source the glob, manifest filename or "-"
+ * @return the input filenames, in order
+ * @throws FileException if the manifest cannot be read
+ * @throws IllegalArgumentException if there are no inputs, or globs aren't
+ *         supported on this platform
+ */
+std::vector<std::string> listBatchInputs(const std::string& source) {
+    std::vector<std::string> inputs;
+    if(source.find_first_of("*?[") != std::string::npos)
+    {
+#ifdef IMANIP_HAS_GLOB
+        glob_t matches;
+        if(glob(source.c_str(), 0, 0, &matches) == 0)
+        {
+            inputs.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+        }
+        globfree(&matches);
+#else
+        throw IllegalArgumentException("Glob patterns are not supported on this platform, use a manifest");
+#endif
+    }
+    else
+    {
+        std::ifstream manifest;
+        if(source != "-")
+        {
+            manifest.open(source.c_str());
+            if(!manifest.good())
+            {
+                throw FileException(source, "Manifest cannot be read or does not exist");
+            }
+        }
+        std::istream& lines = source == "-" ? std::cin : manifest;
+        std::string line;
+        while(std::getline(lines, line))
+        {
+            // drop surrounding whitespace, including a \r from Windows line endings
+            size_t first = line.find_first_not_of(" \t\r");
+            if(first == std::string::npos || line[first] == '#')
+            {
+                continue;
+            }
+            inputs.push_back(line.substr(first, line.find_last_not_of(" \t\r") + 1 - first));
+        }
+    }
+    if(inputs.empty())
+    {
+        throw IllegalArgumentException("No input files found for --batch " + source);
+    }
+    return inputs;
+}
+/**
+ * Gets the filename that the results of one input of a batch are saved to:
+ * the input's own filename, in the output directory.
+ * @param outputDirectory the directory the batch is written to
+ * @param inputFilename the input's filename, which may include directories
+ * @return the output filename
+ */
+std::string getBatchOutputFilename(const std::string& outputDirectory, const std::string& inputFilename) {
+    size_t slash = inputFilename.find_last_of("/\\");
+    std::string name = slash == std::string::npos ? inputFilename : inputFilename.substr(slash + 1);
+    if(outputDirectory.empty() || outputDirectory[outputDirectory.size() - 1] == '/')
+    {
+        return outputDirectory + name;
+    }
+    return outputDirectory + "/" + name;
+}
+
+/**
+ * One input of a batch, as it moves through the stages of the pipeline.
+ */
+struct BatchJob {
+    /** the name of the bitmap file to read */
+    std::string inputFilename;
+    /** the name of the bitmap file to write */
+    std::string outputFilename;
+    /** the images being manipulated */
+    std::vector<RGBImage> images;
+    /** the images being manipulated, with --gray */
+    std::vector<ChannelImage> grayImages;
+    /** the mapped input file, until it has been decoded */
+    std::unique_ptr<MappedBitmap> mappedInput;
+};
+
+/**
+ * Runs one stage of a batch on a job, reporting rather than throwing a failure
+ * so that one bad input doesn't stop the rest of the batch.
+ * @param job the job the stage is run on
+ * @param stage the work of the stage
+ * @param failures counts the jobs that failed
+ * @param outputLock serializes the failure reports
+ * @return true if the stage succeeded
+ */
+template <class Stage>
+bool runBatchStage(BatchJob& job, Stage stage, std::atomic<int>& failures, std::mutex& outputLock) {
+    std::string message;
+    try
+    {
+        stage(job);
+        return true;
+    }
+    catch(FileException& ex)
+    {
+        message = ex.getMessage() + ": " + ex.getFilename();
+    }
+    catch(Exception& ex)
+    {
+        message = ex.getMessage();
+    }
+    catch(std::exception& ex)
+    {
+        message = ex.what();
+    }
+    failures++;
+    std::lock_guard<std::mutex> guard(outputLock);
+    std::cout << job.inputFilename << ": " << message << std::endl;
+    return false;
+}
+
+/**
+ * Runs the same commands over every input of a batch, in one process. Inputs
+ * go through a pipeline of three stages: reader threads load (or map) them,
+ * worker threads run the commands, and writer threads save the results. The
+ * stages are joined by bounded queues, so only a few images per thread are
+ * ever in memory at once however long the batch is. Filters still split their
+ * work over the shared thread pool, so a short batch of large images keeps
+ * every core busy too. An input that fails is reported and skipped.
+ * @param options the options the batch was run with
+ * @param outputDirectory the directory the results are saved in, under the
+ *        inputs' own filenames
+ * @param commands the commands to run over each input
+ * @param stats records the stages of every input, or null
+ * @param cache the cache of results to reuse, or null
+ * @return the number of inputs that failed
+ * @throws FileException if the manifest cannot be read
+ * @throws IllegalArgumentException if there are no inputs, or two inputs
+ *         would be saved to the same file
+ */
+int runBatch(const RunOptions& options, const std::string& outputDirectory,
+             const std::vector<ImageCommand>& commands, StatsRecorder* stats = 0,
+             ResultCache* cache = 0) {
+    std::vector<std::string> inputs = listBatchInputs(options.batchSource);
+    // inputs from different directories may share a name, and would overwrite each other's results
+    std::map<std::string, std::string> outputInputs;
+    for(int i = 0; i < inputs.size(); i++)
+    {
+        std::string outputFilename = getBatchOutputFilename(outputDirectory, inputs[i]);
+        if(!outputInputs.insert(std::make_pair(outputFilename, inputs[i])).second)
+        {
+            throw IllegalArgumentException("Inputs " + outputInputs[outputFilename] + " and " + inputs[i]
+                                           + " would both be saved to " + outputFilename);
+        }
+    }
+    if(options.streamRows)
+    {
+        // fail once up front rather than once for every input
+        getScanlineFilters(commands);
+    }
+    if(options.grayPixels)
+    {
+        assertGrayCommands(commands);
+    }
+
+    int workerCount = std::max(1, std::min<int>(getThreadPool().getThreadCount(), inputs.size()));
+    int ioThreadCount = std::max(1, workerCount / 2);
+    BoundedQueue<BatchJob> loaded(workerCount);
+    BoundedQueue<BatchJob> filtered(ioThreadCount);
+    std::atomic<size_t> nextInput(0);
+    std::atomic<int> failures(0);
+    std::mutex outputLock;
+
+    auto readStage = [&] {
+        nameTraceThread("batch reader");
+        size_t i;
+        while((i = nextInput++) < inputs.size())
+        {
+            BatchJob job;
+            job.inputFilename = inputs[i];
+            job.outputFilename = getBatchOutputFilename(outputDirectory, inputs[i]);
+            bool read = runBatchStage(job, [&options, stats](BatchJob& job) {
+                if(options.streamRows)
+                {
+                    // streamed inputs are read a row at a time by the workers
+                    return;
+                }
+                if(options.grayPixels)
+                {
+                    loadGrayInput(job.inputFilename, job.mappedInput, stats);
+                    return;
+                }
+                loadInput(job.inputFilename, options.mapInput, job.images, job.mappedInput, stats);
+            }, failures, outputLock);
+            if(read)
+            {
+                loaded.push(std::move(job));
+            }
+        }
+    };
+    auto filterStage = [&] {
+        nameTraceThread("batch worker");
+        BatchJob job;
+        while(loaded.pop(job))
+        {
+            bool filteredJob = runBatchStage(job, [&options, &commands, stats, cache](BatchJob& job) {
+                if(options.streamRows)
+                {
+                    StageTimer timer(stats, "stream", job.inputFilename);
+                    TraceScope scope("command", ("stream " + job.inputFilename).c_str());
+                    streamCommands(job.inputFilename, job.outputFilename, commands);
+                    timer.finish(0);
+                }
+                else if(options.grayPixels)
+                {
+                    runGrayCommands(commands, job.grayImages, job.mappedInput, stats);
+                }
+                else if(cache)
+                {
+                    runCachedCommands(*cache, commands, job.images, job.mappedInput, stats);
+                }
+                else
+                {
+                    runCommands(commands, job.images, job.mappedInput, stats);
+                }
+            }, failures, outputLock);
+            if(filteredJob && !options.streamRows)
+            {
+                filtered.push(std::move(job));
+            }
+        }
+    };
+    auto writeStage = [&] {
+        nameTraceThread("batch writer");
+        BatchJob job;
+        while(filtered.pop(job))
+        {
+            runBatchStage(job, [stats](BatchJob& job) {
+                saveResults(job.outputFilename, job.images, stats);
+                saveResults(job.outputFilename, job.grayImages, stats);
+            }, failures, outputLock);
+            job.images.clear();
+            job.grayImages.clear();
+        }
+    };
+
+    std::vector<std::thread> readers, workers, writers;
+    for(int i = 0; i < ioThreadCount; i++)
+    {
+        readers.push_back(std::thread(readStage));
+        writers.push_back(std::thread(writeStage));
+    }
+    for(int i = 0; i < workerCount; i++)
+    {
+        workers.push_back(std::thread(filterStage));
+    }
+    // each stage is closed once every thread feeding it has finished
+    for(int i = 0; i < readers.size(); i++)
+    {
+        readers[i].join();
+    }
+    loaded.close();
+    for(int i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+    filtered.close();
+    for(int i = 0; i < writers.size(); i++)
+    {
+        writers[i].join();
+    }
+
+    if(failures > 0)
+    {
+        std::cout << failures << " of " << inputs.size() << " inputs failed" << std::endl;
+    }
+    return failures;
+}
+
+/**
+ * Reports on a finished run: prints the stats of each stage and writes the
+ * trace, if they were asked for.
+ * @param options the options the run was run with
+ * @param stats the stats recorded during the run
+ * @throws FileException if the trace cannot be written
+ */
+void reportRun(const RunOptions& options, const StatsRecorder& stats) {
+    if(options.statsFormat == "json")
+    {
+        stats.writeJson(std::cout);
+    }
+    else if(options.statsFormat == "table")
+    {
+        stats.writeTable(std::cout);
+    }
+    if(!options.traceFilename.empty())
+    {
+        getTracer().stop();
+        saveTrace(options.traceFilename);
+    }
+}
+
+/**
+ * Parses a set of string literal arguments and runs the resulting set of
+ * Image Manipulations. With --batch, a single output directory takes the
+ * place of the two filenames. With --stats, the stats of each stage are
+ * printed once the run is done, and with --trace a timeline of it is saved.
+ * With --cache, results kept from earlier runs are reused. With --gray, the
+ * image is loaded, filtered and saved as 8-bit gray, or as gray planes if the
+ * first command is cs.
+ * @param argc the total number of arguments 
+ * @param argv the array of string literal arguments
+ * @return 0 on success, or 1 if any input of a batch failed
+ */
+int parseAndRun(int argc, const char** argv) {
+    int index = 0;
+    RunOptions options = parseOptions(index, argc, argv);
+    if(!options.batchSource.empty() && argc - index < 1)
+    {
+        throw IllegalArgumentException("Format is: [options...] --batch <glob|manifest|-> <output_directory> [filters...]");
+    }
+    if(options.batchSource.empty() && argc - index < 2)
+    {
+        throw IllegalArgumentException("Format is: [options...] <input_filename> <output_filename> [filters...]");
+    }
+    if(options.threadCount > 0)
+    {
+        getThreadPool().setThreadCount(options.threadCount);
+    }
+    // a batch adds the stages of every input together
+    StatsRecorder recorder(options.batchSource.empty());
+    StatsRecorder* stats = options.statsFormat.empty() ? 0 : &recorder;
+    if(!options.cacheDirectory.empty() && options.streamRows)
+    {
+        throw IllegalArgumentException("--cache cannot be used with --stream, which never holds a whole image");
+    }
+    if(options.grayPixels && (options.streamRows || !options.cacheDirectory.empty()))
+    {
+        throw IllegalArgumentException("--gray cannot be used with --stream or --cache, which work on color rows");
+    }
+    std::unique_ptr<ResultCache> cache;
+    if(!options.cacheDirectory.empty())
+    {
+        cache.reset(new ResultCache(options.cacheDirectory, options.cacheLimit));
+    }
+    if(!options.traceFilename.empty())
+    {
+        getTracer().start();
+        nameTraceThread("main");
+    }
+    if(!options.batchSource.empty())
+    {
+        std::string outputDirectory = argv[index++];
+        std::vector<ImageCommand> commands = parseCommands(index, argc, argv);
+        if(!options.grayPixels)
+        {
+            // gray curves can't be composed, see runGrayCommands
+            commands = fuseCommands(commands);
+        }
+        if(!options.streamRows)
+        {
+            // a collapsed remap needs the whole image, so only collapse when not streaming
+            commands = collapseRemaps(commands);
+        }
+        int failures = runBatch(options, outputDirectory, commands, stats, cache.get());
+        reportRun(options, recorder);
+        return failures > 0 ? 1 : 0;
+    }
+    std::string inputFilename = argv[index++];
+    std::string outputFilename = argv[index++];
+    std::vector<ImageCommand> commands = parseCommands(index, argc, argv);
+    if(options.grayPixels)
+    {
+        // gray curves can't be composed, see runGrayCommands
+        commands = collapseRemaps(commands);
+        assertGrayCommands(commands);
+        std::vector<ChannelImage> images;
+        std::unique_ptr<MappedBitmap> mappedInput;
+        loadGrayInput(inputFilename, mappedInput, stats);
+        runGrayCommands(commands, images, mappedInput, stats);
+        saveResults(outputFilename, images, stats);
+        reportRun(options, recorder);
+        return 0;
+    }
+    commands = fuseCommands(commands);
+
+    if(options.streamRows)
+    {
+        // streamed stages run a row at a time, interleaved, so they're timed as one
+        StageTimer timer(stats, "stream", inputFilename);
+        {
+            TraceScope scope("command", ("stream " + inputFilename).c_str());
+            streamCommands(inputFilename, outputFilename, commands);
+        }
+        timer.finish(0);
+        reportRun(options, recorder);
+        return 0;
+    }
+    // a collapsed remap needs the whole image, so only collapse when not streaming
+    commands = collapseRemaps(commands);
     
-    // Save the images
-    if(images.size() == 1)
+    std::vector<RGBImage> images;
+    std::unique_ptr<MappedBitmap> mappedInput;
+    loadInput(inputFilename, options.mapInput, images, mappedInput, stats);
+    if(cache)
     {
-        saveImage(outputFilename, images[0]);
+        runCachedCommands(*cache, commands, images, mappedInput, stats);
     }
     else
     {
-        saveImages(outputFilename, images);
+        runCommands(commands, images, mappedInput, stats);
     }
+    saveResults(outputFilename, images, stats);
+    reportRun(options, recorder);
+    return 0;
 }
 
 }
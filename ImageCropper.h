@@ -1,30 +1,33 @@
 #pragma once
 
-#include "ImageFilter.h"
+#include "GeometricFilter.h"
+#include "ScanlineFilter.h"
 #include <iostream>
+#include <sstream>
 using namespace std;
 
 namespace IManip {
 
-class ImageCropper : public ImageFilter {
+class ImageCropper : public GeometricFilter, public ScanlineFilter {
 private:
 
-    //These values are used to get the pixel coordinates.
-
-    int xPixel(int x, int y, int width, int height) {
-        return (x);
-    }
-
-    int yPixel(int x, int y, int width, int height) {
-        return (y);
-    }
-
     //x1 and y1 are the 1st point for the Rectangle, and x2 and x2 are used to create the 2nd point for the Rectangle. 
     int x1;
     int y1;
     int x2;
     int y2;
 
+    //This makes sure a non-empty rectangle lies inside an image of the given size before copying any rows.
+
+    void assertInside(int width, int height) {
+        if (x2 > x1 && y2 > y1 && (x1 < 0 || y1 < 0 || x2 > width || y2 > height)) {
+            std::stringstream stream;
+            stream << "Bounds error: crop (" << x1 << "," << y1 << ") to (" << x2 << "," << y2
+                   << "), width: " << width << " height: " << height;
+            throw IndexOutOfBoundsException(stream.str());
+        }
+    }
+
 public:
 
 
@@ -34,32 +37,53 @@ public:
     : x1(get_x1), y1(get_y1), x2(get_x2), y2(get_y2) {
     }
 
-    //This creates a new image with the size newWidth and newHeight
+    //The cropped image is a view of the source made by GeometricFilter, sharing its pixels starting from the 1st point.
+
+    virtual PixelRemap getRemap(int, int) {
+        return PixelRemap(x2 - x1, y2 - y1, x1, y1, 1, 0, 0, 1);
+    }
+
+    //This crops a mapped bitmap, decoding only the rows and columns inside the rectangle.
 
-    virtual RGBImage filter(const RGBImage& srcImg) {
+    virtual RGBImage filterMapped(const MappedBitmap& srcImg) {
 
         int newWidth = x2 - x1;
         int newHeight = y2 - y1;
 
-        RGBImage Crop(newWidth, newHeight);
+        RGBImage Crop(newWidth, newHeight, false);
 
-        /**By setting x to x1 and y to y1, a new image will be created starting from the 1st point 
-         *given by the user to the 2nd point given in by the user. 
-         *The resulting image is then returned.
-         */
+        assertInside(srcImg.getWidth(), srcImg.getHeight());
+        PixelRows<RGBPixel> rows = Crop.getRows();
 
-        for (int x = x1; x < x2; x++) {
-            for (int y = y1; y < y2; y++) {
-                Crop.setRGB(
-                        xPixel(x - x1, y - y1, srcImg.getWidth(), srcImg.getHeight()),
-                        yPixel(x - x1, y - y1, srcImg.getWidth(), srcImg.getHeight()),
-                        srcImg.getRGB(x, y));
+        parallelForRows(newWidth, newHeight, [&](int begin, int end) {
+            for (int y = y1 + begin; y < y1 + end; y++) {
+                decodeScanline(srcImg.getScanline(y) + x1 * PIXEL_SIZE, rows[y - y1].data(), newWidth);
             }
-        }
+        });
 
         return Crop;
     }
 
+    //When streaming, the cropped image has the size of the rectangle.
+
+    virtual int getFilteredWidth(int width, int height) {
+        assertInside(width, height);
+        return x2 - x1;
+    }
+
+    virtual int getFilteredHeight(int width, int height) {
+        assertInside(width, height);
+        return y2 - y1;
+    }
+
+    //Rows inside the rectangle are handed on without copying, starting from the 1st point, and the rest are dropped.
+
+    virtual void filterScanline(int y, const RGBPixel* row, int, int, ScanlineSink& sink) {
+        if (y >= y1 && y < y2) {
+            sink.putScanline(y - y1, row + x1);
+        }
+    }
+
 };
 
 }
\ No newline at end of file
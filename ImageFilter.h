@@ -1,6 +1,10 @@
 #pragma once
+#include <utility>
 #include <vector>
 #include "RGBImage.h"
+#include "MappedBitmap.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 
 namespace IManip {
 
@@ -12,6 +16,8 @@ namespace IManip {
  */
 class ImageFilter {
 public:
+    virtual ~ImageFilter() {}
+
     /**
      * This virtual function should be overridden by any class inheriting from
      * ImageTransformer. This allows for polymorphic image transformation.
@@ -19,19 +25,58 @@ public:
      * @return a filtered version of the image, not the original image.
      */
     virtual RGBImage filter(const RGBImage& srcImg) = 0;
+    /**
+     * Filters an image by changing it directly, without allocating a new one.
+     * Filters whose output is the same size as their input and can be worked
+     * out over the top of it should override this. By default nothing is
+     * done and false is returned, so callers that own an image should fall
+     * back to filter(const RGBImage&) when this returns false.
+     * @param img the image to filter, which is changed
+     * @return true if the image was filtered, false if it was left alone
+     */
+    virtual bool filterInPlace(RGBImage&) {
+        return false;
+    }
+    /**
+     * Filters an image straight out of a mapped bitmap file. By default the
+     * bitmap is decoded into an RGBImage first, which is then filtered in
+     * place if the filter can. Filters that can read the bitmap scanlines
+     * directly should override this to skip the decode.
+     * @param srcImg the mapped bitmap used in the transformation
+     * @return a filtered version of the image.
+     */
+    virtual RGBImage filterMapped(const MappedBitmap& srcImg) {
+        RGBImage decodedImage = srcImg.decode();
+        if(filterInPlace(decodedImage))
+        {
+            return decodedImage;
+        }
+        return filter(decodedImage);
+    }
     
     /**
      * Applies a specific filter to all of the Images in a vector.
+     * Each filtered image replaces its source in the vector, so passing the
+     * vector in with std::move avoids copying any of the images. Images are
+     * filtered in place where the filter can. The images are filtered
+     * concurrently on the shared thread pool, so filter and filterInPlace
+     * must be safe to call from several threads at once.
      * @param srcImgs the vector of images to be transformed.
-     * @return A new vector containing the transformed images.
+     * @return the vector, now containing the transformed images.
      */
-    std::vector<RGBImage> applyOverVector(const std::vector<RGBImage> srcImgs) {
-        std::vector<RGBImage> transformedImages(srcImgs.size());
-        for(int i = 0; i < srcImgs.size(); i++)
-        {
-            transformedImages[i] = filter(srcImgs[i]);
-        }
-        return transformedImages;
+    std::vector<RGBImage> applyOverVector(std::vector<RGBImage> srcImgs) {
+        // one image per chunk, so idle threads pick up the next image whatever its size
+        parallelFor(0, srcImgs.size(), 1, [&](int begin, int end) {
+            for(int i = begin; i < end; i++)
+            {
+                TraceScope scope("image", "filter", srcImgs[i].getWidth(), srcImgs[i].getHeight());
+                if(!filterInPlace(srcImgs[i]))
+                {
+                    srcImgs[i] = filter(srcImgs[i]);
+                }
+            }
+        });
+        return srcImgs;
     }
 };
 
@@ -44,10 +89,19 @@ public:
  * the filters applied to it.
  */
 RGBImage applyFilters(const std::vector<ImageFilter*>& filters, const RGBImage& srcImg) {
-    RGBImage transformedImage(srcImg);
-    for(int i = 0; i < filters.size(); i++)
+    if(filters.empty())
     {
-        transformedImage = filters[i]->filter(transformedImage);
+        return srcImg;
+    }
+    // the first filter reads the source directly, the rest work on the
+    // intermediate image, in place if they can
+    RGBImage transformedImage = filters[0]->filter(srcImg);
+    for(int i = 1; i < filters.size(); i++)
+    {
+        if(!filters[i]->filterInPlace(transformedImage))
+        {
+            transformedImage = filters[i]->filter(transformedImage);
+        }
     }
     return transformedImage;
 }
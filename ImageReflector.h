@@ -1,5 +1,6 @@
 #pragma once
-#include "ImageFilter.h"
+#include "GeometricFilter.h"
+#include "ScanlineFilter.h"
 #include <iostream>
 
 namespace IManip {
@@ -10,7 +11,7 @@ namespace IManip {
  * Notably, it does not currently have any member variables and does not have
  * a constructor.
  */
-class ImageReflector : public ImageFilter {
+class ImageReflector : public GeometricFilter, public ScanlineFilter {
 private:
 	int getReflectedX(int x, int y, int width, int height) {
 		return (width-1-x);
@@ -21,23 +22,22 @@ private:
 public:
 	ImageReflector() {}
 
-    virtual RGBImage filter(const RGBImage& srcImg) {
-		RGBImage reflectedImage(srcImg.getWidth(), srcImg.getHeight());
+	// a reflection is its own inverse, so the source of each pixel is its reflection
+	virtual PixelRemap getRemap(int width, int height) {
+		return PixelRemap(width, height,
+			getReflectedX(0, 0, width, height), getReflectedY(0, 0, width, height), -1, 0, 0, 1);
+	}
 
-		for(int x = 0; x < srcImg.getWidth(); x++)
+	virtual void filterScanline(int y, const RGBPixel* row, int width, int height,
+	                            ScanlineSink& sink) {
+		// write a reflected copy of the source row, then hand it on
+		RGBPixel* reflectedRow = getScanlineBuffer(width);
+		for(int x = 0; x < width; x++)
 		{
-			for(int y = 0; y < srcImg.getHeight(); y++)
-			{
-				// write a reflected copy of the source pixel to the new image
-				reflectedImage.setRGB(
-					getReflectedX(x, y, srcImg.getWidth(), srcImg.getHeight()),
-					getReflectedY(x, y, srcImg.getWidth(), srcImg.getHeight()),
-					srcImg.getRGB(x, y));
-			}
+			reflectedRow[getReflectedX(x, y, width, height)] = row[x];
 		}
-
-		return reflectedImage;
-    }
+		sink.putScanline(getReflectedY(0, y, width, height), reflectedRow);
+	}
 
 };
 
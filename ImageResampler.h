@@ -0,0 +1,360 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ImageFilter.h"
+#include "Exceptions.h"
+#include "ThreadPool.h"
+
+namespace IManip {
+
+/**
+ * The ways an ImageResampler can work out the pixels of the resized image.
+ */
+enum ResampleMode {
+    RESAMPLE_NEAREST,  /// copies the nearest source pixel
+    RESAMPLE_BILINEAR, /// blends neighbouring pixels linearly
+    RESAMPLE_AREA,     /// averages every source pixel a resized pixel covers, best for shrinking
+    RESAMPLE_LANCZOS   /// windowed sinc over three pixels either side, the sharpest
+};
+
+/**
+ * The weights that one dimension of a resampled image is made from. Each
+ * resampled pixel is a weighted sum of a run of consecutive source pixels.
+ */
+struct ResampleTaps {
+    /** the first source pixel of each resampled pixel */
+    std::vector<int> start;
+    /** the number of source pixels for each resampled pixel */
+    std::vector<int> count;
+    /** the weights of each resampled pixel, maxCount apart */
+    std::vector<float> weights;
+    /** the greatest number of source pixels for any resampled pixel */
+    int maxCount;
+};
+
+/**
+ * Evaluates the filter kernel of a resampling mode.
+ * @param mode the resampling mode
+ * @param x the distance from the centre of the kernel, in source pixels
+ * @return the unnormalized weight at that distance
+ */
+double resampleKernel(ResampleMode mode, double x) {
+    x = std::fabs(x);
+    switch(mode)
+    {
+        case RESAMPLE_BILINEAR:
+            return x < 1 ? 1 - x : 0;
+        case RESAMPLE_AREA:
+            return x <= 0.5 ? 1 : 0;
+        case RESAMPLE_LANCZOS:
+        {
+            const double pi = 3.14159265358979323846;
+            if(x == 0)
+            {
+                return 1;
+            }
+            if(x >= 3)
+            {
+                return 0;
+            }
+            return 3 * std::sin(pi * x) * std::sin(pi * x / 3) / (pi * pi * x * x);
+        }
+        default:
+            return 0;
+    }
+}
+/**
+ * Gets how far the filter kernel of a resampling mode reaches from its centre.
+ * @param mode the resampling mode
+ * @return the radius of the kernel, in source pixels
+ */
+double resampleSupport(ResampleMode mode) {
+    switch(mode)
+    {
+        case RESAMPLE_BILINEAR: return 1;
+        case RESAMPLE_AREA: return 0.5;
+        case RESAMPLE_LANCZOS: return 3;
+        default: return 0.5;
+    }
+}
+
+/**
+ * Works out the weights for resampling one dimension of an image. When
+ * shrinking, the kernel is stretched to cover every source pixel that lands in
+ * a resampled pixel, so nothing is skipped over.
+ * @param srcSize the number of source pixels, at least 1
+ * @param dstSize the number of resampled pixels, at least 1
+ * @param mode the resampling mode
+ * @return the weights of every resampled pixel, each set summing to 1
+ */
+ResampleTaps computeResampleTaps(int srcSize, int dstSize, ResampleMode mode) {
+    ResampleTaps taps;
+    taps.start.resize(dstSize);
+    taps.count.resize(dstSize);
+    double scale = (double)srcSize / dstSize;
+
+    if(mode == RESAMPLE_NEAREST)
+    {
+        taps.maxCount = 1;
+        taps.weights.assign(dstSize, 1.0f);
+        for(int i = 0; i < dstSize; i++)
+        {
+            taps.start[i] = std::min(srcSize - 1, (int)((i + 0.5) * scale));
+            taps.count[i] = 1;
+        }
+        return taps;
+    }
+
+    double kernelScale = std::max(1.0, scale);
+    double support = resampleSupport(mode) * kernelScale;
+    taps.maxCount = (int)std::ceil(support) * 2 + 1;
+    taps.weights.assign((size_t)dstSize * taps.maxCount, 0.0f);
+    for(int i = 0; i < dstSize; i++)
+    {
+        double center = (i + 0.5) * scale;
+        int first = std::max(0, (int)(center - support + 0.5));
+        int last = std::min(srcSize, (int)(center + support + 0.5));
+        float* weights = &taps.weights[(size_t)i * taps.maxCount];
+        double total = 0;
+        for(int x = first; x < last; x++)
+        {
+            double weight = resampleKernel(mode, (x + 0.5 - center) / kernelScale);
+            weights[x - first] = weight;
+            total += weight;
+        }
+        if(total == 0)
+        {
+            // the kernel fell between pixels, so use the nearest one
+            first = std::min(srcSize - 1, (int)center);
+            last = first + 1;
+            weights[0] = 1;
+            total = 1;
+        }
+        for(int x = 0; x < last - first; x++)
+        {
+            weights[x] /= total;
+        }
+        taps.start[i] = first;
+        taps.count[i] = last - first;
+    }
+    return taps;
+}
+
+/**
+ * The fewest source rows a band of resampled rows covers, in kernels. Each
+ * band resamples the source rows it needs across itself, so the rows it shares
+ * with the bands either side are resampled twice; bands several kernels tall
+ * keep those to a small part of the work.
+ */
+const int RESAMPLE_BAND_KERNELS = 8;
+
+/**
+ * Rounds a resampled color value to the nearest byte.
+ * @param value the resampled value, which can overshoot the byte range
+ * @return the value clamped to 0 to BYTE_MAX
+ */
+inline byte resampledByte(float value) {
+    return value <= 0 ? 0 : value >= BYTE_MAX ? BYTE_MAX : (byte)(value + 0.5f);
+}
+
+/**
+ * ImageResampler resizes an image by any positive factor, up or down. It is
+ * separable: each band of resized rows is made by resampling the source rows
+ * it needs across, into a window of float rows, and blending the rows in the
+ * window down. The window only holds as many rows as the kernel covers, and
+ * each source row is resampled across once per band, as the band moves down
+ * over it. The blending down works along whole rows at a time, which the
+ * compiler turns into vector instructions. Nearest neighbour resizing copies
+ * the source pixels straight across instead.
+ */
+class ImageResampler : public ImageFilter {
+private:
+    /** how the resized pixels are worked out */
+    ResampleMode mode;
+    /** the factor the width and height are multiplied by */
+    double factor;
+
+    /**
+     * Gets the size of a dimension after resizing, before it is checked.
+     * @param size the size of the source dimension
+     * @return the resized dimension, at least 1 unless the source is empty
+     */
+    double getResampledSize(int size) const {
+        if(size == 0)
+        {
+            return 0;
+        }
+        return std::max(1.0, std::floor(size * factor + 0.5));
+    }
+    /**
+     * Checks that an image of the resized size can be made.
+     * @param width the resized width
+     * @param height the resized height
+     * @throws IllegalArgumentException if a dimension, or the size of the
+     *         pixels in bytes, is too large for an int
+     */
+    static void checkResampledSize(double width, double height) {
+        if(width > INT_MAX || height > INT_MAX || width * height * PIXEL_SIZE > INT_MAX)
+        {
+            std::stringstream stream;
+            stream << std::fixed << std::setprecision(0) << "Resampled image is too large. Width: " << width << " Height: " << height << "\n";
+            throw IllegalArgumentException(stream.str());
+        }
+    }
+public:
+    /**
+     * Creates an ImageResampler that resizes images by the given factor.
+     * @param mode how the resized pixels are worked out
+     * @param factor the factor to multiply the width and height by, greater than 0
+     * @throws IllegalArgumentException if the factor is not greater than 0
+     */
+    ImageResampler(ResampleMode mode, double factor) : mode(mode), factor(factor) {
+        if(!(factor > 0))
+        {
+            throw IllegalArgumentException("ImageResampler factor must be greater than 0");
+        }
+    }
+
+    /**
+     * Parses the name of a resampling mode.
+     * @param name one of "nearest", "bilinear", "area" or "lanczos"
+     * @return the named mode
+     * @throws IllegalArgumentException if the name is not known
+     */
+    static ResampleMode parseMode(const std::string& name) {
+        if(name == "nearest")
+        {
+            return RESAMPLE_NEAREST;
+        }
+        if(name == "bilinear")
+        {
+            return RESAMPLE_BILINEAR;
+        }
+        if(name == "area")
+        {
+            return RESAMPLE_AREA;
+        }
+        if(name == "lanczos")
+        {
+            return RESAMPLE_LANCZOS;
+        }
+        std::stringstream stream;
+        stream << "Unknown resampling mode: \"" << name
+               << "\", expected nearest, bilinear, area or lanczos";
+        throw IllegalArgumentException(stream.str());
+    }
+
+    /**
+     * Returns a resized copy of the image. Bands of resized rows are worked
+     * out on the shared thread pool.
+     * @param srcImg the base image used in the transformation
+     * @return a resized copy of the image.
+     * @throws IllegalArgumentException if the resized image would be too large
+     */
+    virtual RGBImage filter(const RGBImage& srcImg) {
+        int srcWidth = srcImg.getWidth();
+        int srcHeight = srcImg.getHeight();
+        double resampledWidth = getResampledSize(srcWidth);
+        double resampledHeight = getResampledSize(srcHeight);
+        checkResampledSize(resampledWidth, resampledHeight);
+        RGBImage resampledImage((int)resampledWidth, (int)resampledHeight, false);
+        int width = resampledImage.getWidth();
+        int height = resampledImage.getHeight();
+        if(width == 0 || height == 0)
+        {
+            return resampledImage;
+        }
+        PixelRows<const RGBPixel> srcRows = srcImg.getRows();
+        PixelRows<RGBPixel> destRows = resampledImage.getRows();
+        ResampleTaps xTaps = computeResampleTaps(srcWidth, width, mode);
+        ResampleTaps yTaps = computeResampleTaps(srcHeight, height, mode);
+
+        if(mode == RESAMPLE_NEAREST)
+        {
+            // every resized pixel is a copy of a single source pixel
+            parallelForRows(width, height, [&](int begin, int end) {
+                for(int y = begin; y < end; y++)
+                {
+                    const RGBPixel* srcRow = srcRows[yTaps.start[y]].data();
+                    RGBPixel* dest = destRows[y].data();
+                    for(int x = 0; x < width; x++)
+                    {
+                        dest[x] = srcRow[xTaps.start[x]];
+                    }
+                }
+            });
+            return resampledImage;
+        }
+
+        // bands are sized by the source rows they cover, and cover several
+        // kernels of them so that few are resampled across by two bands
+        int bandSrcRows = std::max(RESAMPLE_BAND_KERNELS * yTaps.maxCount,
+                                   PARALLEL_GRAIN_PIXELS / std::max(1, srcWidth));
+        int bandRows = std::max(1, (int)(bandSrcRows * (double)height / srcHeight));
+        int rowLength = width * PIXEL_SIZE;
+
+        parallelFor(0, height, bandRows, [&](int begin, int end) {
+            // the source rows resampled across, each kept in the slot of its
+            // row number modulo the window size, so the rows of any one
+            // resized row never share a slot. The window is the same size
+            // however many rows the band has, even when the loop isn't split
+            // and the band is the whole image.
+            int windowSize = yTaps.maxCount;
+            std::vector<float> window((size_t)windowSize * rowLength);
+            std::vector<int> windowRows(windowSize, -1);
+            std::vector<float> sum(rowLength);
+            for(int y = begin; y < end; y++)
+            {
+                const float* weights = &yTaps.weights[(size_t)y * yTaps.maxCount];
+                std::fill(sum.begin(), sum.end(), 0.0f);
+                for(int i = 0; i < yTaps.count[y]; i++)
+                {
+                    int srcY = yTaps.start[y] + i;
+                    float* row = &window[(size_t)(srcY % windowSize) * rowLength];
+                    if(windowRows[srcY % windowSize] != srcY)
+                    {
+                        // resample the source row across into its slot
+                        const RGBPixel* srcRow = srcRows[srcY].data();
+                        for(int x = 0; x < width; x++)
+                        {
+                            const RGBPixel* src = srcRow + xTaps.start[x];
+                            const float* xWeights = &xTaps.weights[(size_t)x * xTaps.maxCount];
+                            float r = 0, g = 0, b = 0;
+                            for(int j = 0; j < xTaps.count[x]; j++)
+                            {
+                                r += xWeights[j] * src[j].r;
+                                g += xWeights[j] * src[j].g;
+                                b += xWeights[j] * src[j].b;
+                            }
+                            row[x*PIXEL_SIZE] = r;
+                            row[x*PIXEL_SIZE + 1] = g;
+                            row[x*PIXEL_SIZE + 2] = b;
+                        }
+                        windowRows[srcY % windowSize] = srcY;
+                    }
+                    // then blend it down, a whole row at a time
+                    float weight = weights[i];
+                    for(int j = 0; j < rowLength; j++)
+                    {
+                        sum[j] += weight * row[j];
+                    }
+                }
+                PixelSpan<RGBPixel> dest = destRows[y];
+                for(int x = 0; x < width; x++)
+                {
+                    dest[x].r = resampledByte(sum[x*PIXEL_SIZE]);
+                    dest[x].g = resampledByte(sum[x*PIXEL_SIZE + 1]);
+                    dest[x].b = resampledByte(sum[x*PIXEL_SIZE + 2]);
+                }
+            }
+        });
+        return resampledImage;
+    }
+};
+
+}
@@ -1,6 +1,6 @@
 #pragma once
 #include <iostream>
-#include "ImageFilter.h"
+#include "GeometricFilter.h"
 #include "Exceptions.h"
 
 namespace IManip {
@@ -9,33 +9,11 @@ namespace IManip {
  * It inherits from ImageTransformer,
  * and overrides the transform(const RGBImage&) function.
  */
-class ImageRotator : public ImageFilter {
+class ImageRotator : public GeometricFilter {
 private:
     /** rotate determines the amount of times ImageRotator rotates the image */
     int rotate;
 
-    int get_rotated_x(int x, int y, int width, int height) {
-        switch (rotate) /// this switch statement takes the input of rotate and checks cases
-        {
-            case 0: return x;
-            case 1: return height - y - 1;
-            case 2: return width - x - 1;
-            case 3: return y;
-            default: throw Exception("We should never get here, rotations");
-        }
-    }
-
-    int get_rotated_y(int x, int y, int width, int height) {
-        switch (rotate) /// this switch statement takes the input of rotate and checks cases
-        {
-            case 0: return y;
-            case 1: return x;
-            case 2: return height - y - 1;
-            case 3: return width - x - 1;
-            default: throw Exception("We should never get here, rotations");
-        }
-    }
-
     /**
      * The following function determines the rotated image's width.
      * Using modulus, if the rotate input is even, then the width stays the same,
@@ -80,33 +58,23 @@ public:
         }
     }
 
-    RGBImage filter(const RGBImage& srcImg) {
-        /// allocating a new image that is of the appropriate size, determined
-        /// by the source image's dimensions.
-        RGBImage rotatedImage(
-                get_rotated_width(srcImg.getWidth(), srcImg.getHeight()),
-                get_rotated_height(srcImg.getWidth(), srcImg.getHeight()));
-
-        /// takes in every pixel of the source image
-        for (int x = 0; x < srcImg.getWidth(); x++) 
+    /**
+     * The following function gives the source pixel for every pixel of the
+     * rotated image. It is the inverse of moving each source pixel (x, y) to
+     * (height - y - 1, x) once for every counter clock-wise rotation, and the
+     * rotated image is filled in from it by GeometricFilter.
+     */
+    virtual PixelRemap getRemap(int width, int height) {
+        int rotatedWidth = get_rotated_width(width, height);
+        int rotatedHeight = get_rotated_height(width, height);
+        switch (rotate) /// this switch statement takes the input of rotate and checks cases
         {
-            for (int y = 0; y < srcImg.getHeight(); y++) 
-            {
-                /**
-                 * The pixels are re-coordinated to the new points determined by
-                 * the get_rotated functions.
-                 */
-                rotatedImage.setRGB(
-                        get_rotated_x(x, y, srcImg.getWidth(), srcImg.getHeight()),
-                        get_rotated_y(x, y, srcImg.getWidth(), srcImg.getHeight()),
-                        srcImg.getRGB(x, y));
-
-
-
-            }
+            case 0: return PixelRemap::identity(width, height);
+            case 1: return PixelRemap(rotatedWidth, rotatedHeight, 0, height - 1, 0, -1, 1, 0);
+            case 2: return PixelRemap(rotatedWidth, rotatedHeight, width - 1, height - 1, -1, 0, 0, -1);
+            case 3: return PixelRemap(rotatedWidth, rotatedHeight, width - 1, 0, 0, 1, -1, 0);
+            default: throw Exception("We should never get here, rotations");
         }
-
-        return rotatedImage; /// returns the rotated image
     }
 
 };
@@ -1,6 +1,9 @@
 #pragma once
+#include <algorithm>
 #include "ImageFilter.h"
+#include "ScanlineFilter.h"
 #include "Exceptions.h"
+#include "ThreadPool.h"
 
 namespace IManip {
     
@@ -9,7 +12,7 @@ namespace IManip {
  * the constructor of the ImageScaler. It inherits from ImageTransformer, and
  * overrides the transform(const RGBImage&) function.
  */
-class ImageScaler : public ImageFilter {
+class ImageScaler : public ImageFilter, public ScanlineFilter {
 private:
     int scale; /// The scale that every image passed in is scaled up by
 public:
@@ -29,41 +32,82 @@ public:
      * ImageScaler's transform(const RGBImage&) function returns a scaled up
      * copy of the image passed to it by reference. The factor by which the
      * image is scaled up is determined by ImageScaler's scale member variable,
-     * which is initialized at construction.
+     * which is initialized at construction. Each scaled row is built once and
+     * then copied whole into the rows below it, and bands of source rows are
+     * scaled on the shared thread pool.
      * @param srcImg the base image used in the transformation
      * @return a scaled up copy of the image.
      */
     virtual RGBImage filter(const RGBImage& srcImg) {
         // allocating a new image that is of the appropriate size, determined
         // by the source image's dimensions and the scale.
-        RGBImage scaledImage(srcImg.getWidth()*scale, srcImg.getHeight()*scale);
+        RGBImage scaledImage(srcImg.getWidth()*scale, srcImg.getHeight()*scale, false);
+        PixelRows<const RGBPixel> srcRows = srcImg.getRows();
+        PixelRows<RGBPixel> scaledRows = scaledImage.getRows();
         
-        // for every pixel in the source image
-        for(int x = 0; x < srcImg.getWidth(); x++)
-        {
-            for(int y = 0; y < srcImg.getHeight(); y++)
+        // for every row in the source image, a band of rows at a time
+        parallelForRows(scaledImage.getWidth()*scale, srcImg.getHeight(), [&](int begin, int end) {
+            for(int y = begin; y < end; y++)
             {
-                // load the pixel from the source image
-                RGBPixel pix = srcImg.getRGB(x, y);
-                // then store that pixel the appropriate number of times
-                // in the new image
-                
-                int scaled_x = x*scale;
-                int scaled_y = y*scale;
-                
-                for(int xs = 0; xs < scale; xs++)
+                PixelSpan<const RGBPixel> srcRow = srcRows[y];
+                // build the first of the scaled rows, storing each source
+                // pixel the appropriate number of times
+                RGBPixel* scaledRow = scaledRows[y*scale].data();
+                for(int x = 0; x < srcRow.size(); x++)
                 {
-                    for (int ys = 0; ys < scale; ys++)
-                    {
-                        scaledImage.setRGB(scaled_x + xs, scaled_y + ys, pix);
-                    }
+                    std::fill(scaledRow + x*scale, scaledRow + (x + 1)*scale, srcRow[x]);
+                }
+                // every source row becomes scale identical rows in the new image
+                for(int ys = 1; ys < scale; ys++)
+                {
+                    std::copy(scaledRow, scaledRow + scaledRows.getWidth(),
+                              scaledRows[y*scale + ys].data());
                 }
-
             }
-        }
+        });
 
         return scaledImage;
     }
+    
+    /**
+     * Gets the width of the scaled up images.
+     * @param width the width of the source image
+     * @param height the height of the source image
+     * @return the width of the scaled image
+     */
+    virtual int getFilteredWidth(int width, int) {
+        return width*scale;
+    }
+    /**
+     * Gets the height of the scaled up images.
+     * @param width the width of the source image
+     * @param height the height of the source image
+     * @return the height of the scaled image
+     */
+    virtual int getFilteredHeight(int, int height) {
+        return height*scale;
+    }
+    /**
+     * Scales up a single row of an image that is being streamed. The scaled
+     * row is built once and then handed on scale times, bottom row first.
+     * @param y the y coordinate of the source row
+     * @param row the first of the source row's pixels
+     * @param width the width of the source image
+     * @param height the height of the source image
+     * @param sink where the scaled rows are handed on to
+     */
+    virtual void filterScanline(int y, const RGBPixel* row, int width, int,
+                                ScanlineSink& sink) {
+        RGBPixel* scaledRow = getScanlineBuffer(width*scale);
+        for(int x = 0; x < width; x++)
+        {
+            std::fill(scaledRow + x*scale, scaledRow + (x + 1)*scale, row[x]);
+        }
+        for(int ys = scale - 1; ys >= 0; ys--)
+        {
+            sink.putScanline(y*scale + ys, scaledRow);
+        }
+    }
 };
 
 }
@@ -1,6 +1,10 @@
 #pragma once
+#include <iterator>
+#include <utility>
 #include <vector>
 #include "RGBImage.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 
 namespace IManip {
 
@@ -11,6 +15,8 @@ namespace IManip {
  */
 class ImageSeparator {
 public:
+    virtual ~ImageSeparator() {}
+
     /** 
      * Separates the source image into component images of some kind.
      * How the images are separated depends on the ImageSeparater implementation.
@@ -21,18 +27,37 @@ public:
     
     /**
      * Applies a specific separator to all of the Images in a vector.
+     * The images are separated concurrently on the shared thread pool, so
+     * separate must be safe to call from several threads at once. The
+     * separated images keep the order of their sources.
+     * Pass the vector in with std::move to avoid copying it.
      * @param srcImgs the vector of images to be separated.
      * @return A new vector containing all of the separated images.
      */
-    std::vector<RGBImage> applyOverVector(const std::vector<RGBImage> srcImgs) {
-        std::vector<RGBImage> separatedImages;
-        for(int i = 0; i < srcImgs.size(); i++)
-        {
-            std::vector<RGBImage> cachedImages = separate(srcImgs[i]);
-            for(int j = 0; j < cachedImages.size(); j++)
+    std::vector<RGBImage> applyOverVector(std::vector<RGBImage> srcImgs) {
+        std::vector<std::vector<RGBImage> > cachedImages(srcImgs.size());
+        // one image per chunk, so idle threads pick up the next image whatever its size
+        parallelFor(0, srcImgs.size(), 1, [&](int begin, int end) {
+            for(int i = begin; i < end; i++)
             {
-                separatedImages.push_back(cachedImages[j]);
+                TraceScope scope("image", "separate", srcImgs[i].getWidth(), srcImgs[i].getHeight());
+                cachedImages[i] = separate(srcImgs[i]);
+                // the source image is no longer needed once it has been separated
+                srcImgs[i] = RGBImage();
             }
+        });
+
+        size_t separatedCount = 0;
+        for(size_t i = 0; i < cachedImages.size(); i++)
+        {
+            separatedCount += cachedImages[i].size();
+        }
+        std::vector<RGBImage> separatedImages;
+        separatedImages.reserve(separatedCount);
+        for(size_t i = 0; i < cachedImages.size(); i++)
+        {
+            std::move(cachedImages[i].begin(), cachedImages[i].end(),
+                      std::back_inserter(separatedImages));
         }
         return separatedImages;
     }
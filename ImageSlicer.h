@@ -31,6 +31,7 @@ public:
 
     /**
      * Slices the source image into the specified number of rows and columns.
+     * Each slice is a view that shares the source image's pixels.
      * @param srcImg the image to slice.
      * @return a vector of images containing the subimages.
      */
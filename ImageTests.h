@@ -2,15 +2,28 @@
 #include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include "Test.h"
-#include "Coloramplifier.h"
+#include "ColorAmplifier.h"
+#include "ChannelImage.h"
 #include "ColorInverter.h"
 #include "ColorSplitter.h"
+#include "GammaCorrector.h"
 #include "ImageReflector.h"
+#include "ImageResampler.h"
 #include "ImageRotator.h"
 #include "ImageScaler.h"
 #include "ImageSeparator.h"
 #include "ImageSlicer.h"
+#include "LevelsAdjuster.h"
+#include "GeometricFilter.h"
+#include "MappedBitmap.h"
+#include "PixelFilter.h"
+#include "PixelFormats.h"
+#include "ResultCache.h"
+#include "ScanlineStream.h"
+#include "StageStats.h"
+#include "Trace.h"
 
 namespace IManip {
 
@@ -84,11 +97,31 @@ public:
         // test the ImageRotator
         ImageRotator rotator(1);
         test_(RGBImage("images/test/test_rotated_1.bmp") == rotator.filter(testImage));
+        test_(testImage == ImageRotator(3).filter(rotator.filter(testImage)));
+        test_(testImage == ImageRotator(2).filter(ImageRotator(2).filter(testImage)));
         
         // test the ImageScaler
         ImageScaler scaler(2);
         test_(RGBImage("images/test/test_scaled_2.bmp") == scaler.filter(testImage));
         
+        // test the ImageResampler against the integer scaler and itself
+        test_(RGBImage("images/test/test_scaled_2.bmp") == ImageResampler(RESAMPLE_NEAREST, 2).filter(testImage));
+        test_(testImage == ImageResampler(RESAMPLE_AREA, 0.5).filter(scaler.filter(testImage)));
+        test_(testImage == ImageResampler(RESAMPLE_LANCZOS, 1).filter(testImage));
+        // test that a resampled size too large for an int is refused
+        bool resampleThrew = false;
+        try
+        {
+            ImageResampler(RESAMPLE_LANCZOS, 1e9).filter(testImage);
+        }
+        catch(const IllegalArgumentException&)
+        {
+            resampleThrew = true;
+        }
+        test_(resampleThrew);
+        RGBImage thumbnail = ImageResampler(RESAMPLE_BILINEAR, 0.3).filter(testImage);
+        test_(thumbnail.getWidth() == 90 && thumbnail.getHeight() == 90);
+        
         // test the ImageReflector
         ImageReflector reflector;
         test_(RGBImage("images/test/test_reflected.bmp") == reflector.filter(testImage));
@@ -105,9 +138,220 @@ public:
         ImageSlicer slicer(3, 3);
         test_(RGBImage("images/test/test_sliced_3x3_4.bmp") == slicer.separate(testImage)[4]);
         
+        // test that crops and slices share the source's pixels, and that writing
+        // to a shared image copies it first
+        RGBImage cropped = cropper.filter(testImage);
+        test_(cropped.sharesPixelsWith(testImage) && slicer.separate(testImage)[4].sharesPixelsWith(testImage));
+        RGBImage written = cropped;
+        written.setRGB(0, 0, RGBPixel(1, 2, 3));
+        test_(!written.sharesPixelsWith(testImage) && cropped == testImage.subImage(50, 50, 200, 200)
+              && written != cropped && RGBImage("images/test/test_crop_50_50_250_250.bmp") == cropped);
+        
+        // test that filtering in place matches filtering into a new image, and
+        // leaves any image that shared the pixels alone
+        RGBImage inPlace = testImage;
+        test_(inverter.filterInPlace(inPlace) && reflector.filterInPlace(inPlace)
+              && ImageRotator(2).filterInPlace(inPlace) && !rotator.filterInPlace(inPlace));
+        test_(inPlace == ImageRotator(2).filter(reflector.filter(inverter.filter(testImage)))
+              && testImage == RGBImage("images/test.bmp"));
+
+        // test that the unchecked pixel algorithms match the filters, and that
+        // the checked accessors still throw
+        RGBImage transformed(testImage.getWidth(), testImage.getHeight());
+        transformPixels(testImage, transformed, [](const RGBPixel& pixel) {
+            return RGBPixel(BYTE_MAX - pixel.r, BYTE_MAX - pixel.g, BYTE_MAX - pixel.b);
+        });
+        long redTotal = 0;
+        forEachPixel(testImage, [&redTotal](const RGBPixel& pixel) { redTotal += pixel.r; });
+        long invertedRedTotal = 0;
+        forEachPixel(transformed, [&invertedRedTotal](const RGBPixel& pixel) { invertedRedTotal += pixel.r; });
+        test_(transformed == inverter.filter(testImage)
+              && redTotal + invertedRedTotal == (long)BYTE_MAX * testImage.getWidth() * testImage.getHeight());
+        bool threw = false;
+        try
+        {
+            testImage.getRGB(testImage.getWidth(), 0);
+        }
+        catch(const IndexOutOfBoundsException&)
+        {
+            threw = true;
+        }
+        test_(threw);
+
+        // test that a released buffer is reused for the next image of its size,
+        // and that an image in a recycled buffer still starts out black
+        BufferPool pool;
+        pool.release(pool.allocate(100000, false));
+        void* recycled = pool.allocate(110000, true);
+        test_(pool.getStats().hits == 1 && pool.getStats().misses == 1
+              && BufferPool::getSizeClass(110000) == BufferPool::getSizeClass(100000));
+        pool.release(recycled);
+        RGBImage dirty(300, 300);
+        dirty.setRGB(299, 299, RGBPixel(1, 2, 3));
+        dirty = RGBImage();
+        test_(RGBImage(300, 300).getRGB(299, 299) == RGBPixel(0, 0, 0));
+
+        // test that a stored result loads back the same, that other keys miss,
+        // even one filed under the same hash, and that a view hashes the same
+        // as a copy of its pixels
+        ResultCache cache("images/test/cache");
+        std::vector<RGBImage> cached(1, cropper.filter(testImage)), loaded;
+        CacheKey key(42, "ic 50 50 250 250");
+        cache.store(key, cached);
+        rename(cache.getEntryFilename(key).c_str(), cache.getEntryFilename(CacheKey(43, "ci")).c_str());
+        test_(!cache.load(key, loaded) && !cache.load(CacheKey(43, "ci"), loaded));
+        cache.store(key, cached);
+        test_(cache.load(key, loaded) && loaded.size() == 1 && loaded[0] == cached[0]
+              && hashImage(testImage.subImage(50, 50, 200, 200)) == hashImage(cached[0])
+              && hashImage(testImage) != hashImage(cached[0]));
+        remove(cache.getEntryFilename(key).c_str());
+        remove(cache.getEntryFilename(CacheKey(43, "ci")).c_str());
+        remove("images/test/cache");
+
+        // test that stages of the same name are added together, with the
+        // buffers they allocated, and that a null recorder records nothing
+        StatsRecorder recorder(false);
+        for(int i = 0; i < 2; i++)
+        {
+            StageTimer timer(&recorder, "decode", "images/test.bmp");
+            RGBImage decoded("images/test.bmp");
+            timer.finish((long long)decoded.getWidth() * decoded.getHeight());
+        }
+        StageTimer unrecorded(0, "ignored");
+        unrecorded.finish(1);
+        std::vector<StageStats> stages = recorder.getStages();
+        test_(stages.size() == 1 && stages[0].name == "decode" && stages[0].count == 2
+              && stages[0].pixels == 2LL * testImage.getWidth() * testImage.getHeight()
+              && stages[0].allocatedBytes >= 2 * sizeof(RGBPixel) * testImage.getStride() * testImage.getHeight());
+
+        // test that every pixel format loads, filters and converts back to the
+        // same pixels as the 24-bit filters
+        RGBX32Image rgbx = loadPixelImage<RGBX32>("images/test.bmp");
+        invertImage(rgbx);
+        test_(RGBImage("images/test/test_inverted.bmp") == toRGBImage(rgbx));
+        RGBA32Image rgba = fromRGBImage<RGBA32>(testImage);
+        curveImage(rgba, amplifier);
+        test_(RGBImage("images/test/test_amped_0-75_0-5_0-3.bmp") == toRGBImage(rgba)
+              && rgba.getPixel(10, 10).a == BYTE_MAX);
+        test_(RGBImage("images/test/test_rotated_1.bmp")
+              == RGBImage(remapPixelImage(loadPixelImage<RGB24>("images/test.bmp"), rotator.getRemap(300, 300))));
+        ChannelImage gray = loadPixelImage<Gray8>("images/test.bmp");
+        test_(gray == fromRGBImage<Gray8>(testImage) && toRGBImage(gray).getRGB(5, 5).r == gray.getPixel(5, 5).v);
+        // rows of pixels that divide a cache line start on one, and 24-bit rows on 16 bytes
+        test_(RGBA32Image(1, 1).getStride()*sizeof(RGBA32) == BUFFER_ALIGNMENT
+              && ChannelImage(1, 1).getStride() == BUFFER_ALIGNMENT && RGBImage(1, 1).getStride() == ROW_ALIGNMENT);
+
         // test the ColorSplitter
         ColorSplitter splitter;
         test_(RGBImage("images/test/test_color_split_1.bmp") == splitter.separate(testImage)[1]);
+        std::vector<ChannelImage> planes = splitter.splitChannels(testImage);
+        test_(planes.size() == 3 && RGBImage("images/test/test_color_split_1.bmp") == toRGBImage(planes[1], 1)
+              && splitter.separate(testImage)[2] == toRGBImage(planes[2], 2));
+        std::vector<ChannelImage> mappedPlanes = splitter.splitChannels(MappedBitmap("images/test.bmp"));
+        test_(mappedPlanes[0] == planes[0] && mappedPlanes[1] == planes[1] && mappedPlanes[2] == planes[2]);
+        
+        // test that every instruction set the inverter can use gives the same bytes
+        for(int level = SIMD_SCALAR; level <= detectSimdLevel(); level++)
+        {
+            setSimdLevel((SimdLevel)level);
+            test_(RGBImage("images/test/test_inverted.bmp") == inverter.filter(testImage));
+            test_(planes[0] == splitter.splitChannels(testImage)[0]);
+        }
+        setSimdLevel(detectSimdLevel());
+        
+        // test that neutral curves leave the image alone, and that curves compose
+        test_(testImage == GammaCorrector(1, 1, 1).filter(testImage));
+        test_(testImage == LevelsAdjuster(0, BYTE_MAX).filter(testImage));
+        GammaCorrector gamma(2.2, 1.0, 0.45);
+        LevelsAdjuster levels(20, 230);
+        std::vector<std::shared_ptr<PixelFilter> > curveFilters;
+        curveFilters.push_back(std::make_shared<ColorAmplifier>(1.7, 2.5, 0.0));
+        curveFilters.push_back(std::make_shared<GammaCorrector>(2.2, 1.0, 0.45));
+        curveFilters.push_back(std::make_shared<LevelsAdjuster>(20, 230));
+        FusedPixelFilter curves(curveFilters);
+        test_(levels.filter(gamma.filter(ColorAmplifier(1.7, 2.5, 0.0).filter(testImage)))
+              == curves.filter(testImage));
+        
+        // test that fused pointwise filters match the filters run one by one
+        std::vector<std::shared_ptr<PixelFilter> > fusedFilters;
+        fusedFilters.push_back(std::make_shared<ColorInverter>());
+        fusedFilters.push_back(std::make_shared<ColorAmplifier>(0.75, 0.5, 0.3));
+        FusedPixelFilter fused(fusedFilters);
+        test_(amplifier.filter(inverter.filter(testImage)) == fused.filter(testImage));
+        
+        // test that collapsed geometric filters match the filters run one by one
+        std::vector<std::shared_ptr<GeometricFilter> > remapFilters;
+        remapFilters.push_back(std::make_shared<ImageRotator>(1));
+        remapFilters.push_back(std::make_shared<ImageReflector>());
+        remapFilters.push_back(std::make_shared<ImageCropper>(50, 50, 250, 250));
+        RemapFilter remap(remapFilters);
+        test_(cropper.filter(reflector.filter(rotator.filter(testImage))) == remap.filter(testImage));
+        
+        // test that filtering on one thread matches filtering on the whole pool
+        int threadCount = getThreadPool().getThreadCount();
+        getThreadPool().setThreadCount(1);
+        RGBImage singleThreaded = remap.filter(amplifier.filter(testImage));
+        RGBImage singleResampled = ImageResampler(RESAMPLE_LANCZOS, 2.5).filter(testImage);
+        getThreadPool().setThreadCount(std::max(threadCount, 4));
+        test_(singleThreaded == remap.filter(amplifier.filter(testImage)));
+        test_(singleResampled == ImageResampler(RESAMPLE_LANCZOS, 2.5).filter(testImage));
+        std::vector<std::atomic<int> > visits(1000);
+        parallelFor(0, visits.size(), 7, [&](int begin, int end) {
+            for(int i = begin; i < end; i++)
+            {
+                visits[i]++;
+            }
+        });
+        test_(std::count(visits.begin(), visits.end(), 1) == visits.size());
+        
+        // test that separating and filtering vectors on the pool keeps the images in order,
+        // and that each image is traced once whichever thread it ran on
+        getTracer().start();
+        std::vector<RGBImage> tiles = slicer.applyOverVector(splitter.separate(testImage));
+        tiles = inverter.applyOverVector(std::move(tiles));
+        getTracer().stop();
+        test_(tiles.size() == 27 && tiles[4] == inverter.filter(slicer.separate(splitter.separate(testImage)[0])[4])
+              && tiles[22] == inverter.filter(slicer.separate(splitter.separate(testImage)[2])[4]));
+        std::stringstream trace;
+        getTracer().writeJson(trace);
+        std::string traceText = trace.str();
+        int separateEvents = 0, filterEvents = 0;
+        for(size_t at = 0; (at = traceText.find("\"name\": \"", at)) != std::string::npos; at++)
+        {
+            separateEvents += traceText.compare(at + 8, 10, "\"separate\"") == 0;
+            filterEvents += traceText.compare(at + 8, 8, "\"filter\"") == 0;
+        }
+        test_(separateEvents == 3 && filterEvents == 27);
+        
+        // test that a name too long for an event keeps its end, where the basename is
+        getTracer().start();
+        {
+            TraceScope scope("io", ("decode " + std::string(TRACE_NAME_LENGTH, 'd') + "/test.bmp").c_str());
+        }
+        getTracer().stop();
+        trace.str("");
+        getTracer().writeJson(trace);
+        std::string name = "\"..." + std::string(TRACE_NAME_LENGTH - 13, 'd') + "/test.bmp\"";
+        test_(trace.str().find("\"name\": " + name) != std::string::npos);
+        getThreadPool().setThreadCount(threadCount);
+        
+        // test that a mapped bitmap decodes to the same image as a loaded one
+        MappedBitmap mappedImage("images/test.bmp");
+        test_(testImage == mappedImage.decode());
+        
+        // test filtering straight from a mapped bitmap
+        test_(RGBImage("images/test/test_inverted.bmp") == inverter.filterMapped(mappedImage));
+        test_(RGBImage("images/test/test_crop_50_50_250_250.bmp") == cropper.filterMapped(mappedImage));
+        
+        // test that a mapped bitmap hashes the same as the image it decodes to, for the cache
+        test_(hashImage(mappedImage) == hashImage(testImage));
+        
+        // test streaming an image a row at a time through row-local filters
+        std::vector<ScanlineFilter*> streamedFilters;
+        streamedFilters.push_back(&inverter);
+        streamFilters("images/test.bmp", "images/test/test_streamed.bmp", streamedFilters);
+        test_(RGBImage("images/test/test_inverted.bmp") == RGBImage("images/test/test_streamed.bmp"));
+        remove("images/test/test_streamed.bmp");
     }
 };
 
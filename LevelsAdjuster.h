@@ -0,0 +1,46 @@
+#pragma once
+#include <sstream>
+#include "ColorCurve.h"
+#include "Exceptions.h"
+
+namespace IManip {
+
+/**
+ * LevelsAdjuster stretches the colors of an image between a black point and
+ * a white point. Values at or below the black point become 0, values at or
+ * above the white point become BYTE_MAX, and the values in between are spread
+ * linearly across the whole range. The same levels are used for every channel.
+ */
+class LevelsAdjuster : public ColorCurve {
+public:
+    /**
+     * Constructs a LevelsAdjuster with the given black and white points.
+     * @param black the value that becomes 0, from 0 to BYTE_MAX
+     * @param white the value that becomes BYTE_MAX, greater than black and
+     *        no more than BYTE_MAX
+     * @throws IllegalArgumentException if the points are out of range or
+     *         black is not less than white
+     */
+    LevelsAdjuster(int black, int white) {
+        if(black < 0 || white > BYTE_MAX || black >= white)
+        {
+            std::stringstream stream;
+            stream << "Levels must satisfy 0 <= black < white <= " << BYTE_MAX
+                   << ". Black: " << black << " White: " << white;
+            throw IllegalArgumentException(stream.str());
+        }
+        int range = white - black;
+        for(int value = 0; value < CHANNEL_VALUES; value++)
+        {
+            int adjusted = value <= black ? 0
+                         : value >= white ? BYTE_MAX
+                         : ((value - black) * BYTE_MAX + range / 2) / range;
+            for(int channel = 0; channel < PIXEL_SIZE; channel++)
+            {
+                setCurve(channel, value, adjusted);
+            }
+        }
+    }
+};
+
+}
@@ -0,0 +1,204 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include "Exceptions.h"
+#include "RGBImage.h"
+#include "ThreadPool.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IMANIP_HAS_MMAP 1
+#endif
+
+namespace IManip {
+
+/**
+ * MappedBitmap is a read-only view of the pixel data of a bitmap file. Where
+ * the platform supports it the file is memory mapped, so nothing is decoded or
+ * copied when it is opened and the pages are shared with any other process
+ * reading the same file. Otherwise the file is read into memory once.
+ * The pixel data is left in the bitmap layout: scanlines are stored bottom-up,
+ * each pixel is b,g,r, and each scanline is padded to a multiple of 4 bytes.
+ * Coordinates are still given with the origin at the top left, like RGBImage.
+ */
+class MappedBitmap {
+private:
+    /** the first byte of the file */
+    const byte* data;
+    /** the size of the file in bytes */
+    size_t size;
+    /** holds the file when it could not be mapped */
+    std::vector<byte> contents;
+    /** the image width in pixels */
+    int width;
+    /** the image height in pixels */
+    int height;
+    /** the offset of the first (bottom) scanline in the file */
+    int dataStart;
+    /** the number of bytes in a scanline, padding included */
+    int scanlineSize;
+
+    // A mapping can only be released once, so MappedBitmaps can't be copied
+    MappedBitmap(const MappedBitmap&);
+    MappedBitmap& operator=(const MappedBitmap&);
+
+    /**
+     * Releases the mapping, if the file was mapped.
+     */
+    void unmap() {
+#ifdef IMANIP_HAS_MMAP
+        if(data && contents.empty())
+        {
+            munmap(const_cast<byte*>(data), size);
+        }
+#endif
+        data = 0;
+    }
+    /**
+     * Reads the whole file into memory, for when it cannot be mapped.
+     * @param filename the name of the file to read.
+     * @throws FileException if the file cannot be read.
+     */
+    void readContents(const std::string& filename) {
+        std::ifstream ifs(filename.c_str(), std::ios::in | std::ios::binary);
+        if(!ifs.good())
+        {
+            throw FileException(filename, "File cannot be read or does not exist");
+        }
+        ifs.seekg(0, std::ios::end);
+        size = (size_t)ifs.tellg();
+        ifs.seekg(0);
+        contents.resize(std::max<size_t>(1, size));
+        ifs.read(reinterpret_cast<char*>(&contents[0]), size);
+        data = &contents[0];
+    }
+public:
+    /**
+     * Opens the bitmap file with the given filename and maps its contents.
+     * @param filename the name of the bitmap file to map.
+     * @throws FileException if the file does not exist, is not a bitmap, or is corrupt.
+     */
+    MappedBitmap(std::string filename) : data(0), size(0) {
+#ifdef IMANIP_HAS_MMAP
+        int fd = open(filename.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            throw FileException(filename, "File cannot be read or does not exist");
+        }
+        struct stat info;
+        if(fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            size = (size_t)info.st_size;
+            void* mapping = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+            if(mapping != MAP_FAILED)
+            {
+                data = static_cast<const byte*>(mapping);
+                // filters read the pixels front to back, once
+                madvise(mapping, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+#endif
+        if(!data)
+        {
+            readContents(filename);
+        }
+
+        // make sure that the file opened is of a valid bitmap
+        try
+        {
+            parseHeader(data, size, filename, width, height, dataStart);
+        }
+        catch(FileException&)
+        {
+            unmap();
+            throw;
+        }
+        scanlineSize = width * PIXEL_SIZE + getScanlinePadding(width);
+
+        // make sure that all of the scanlines the header promises are really there
+        if(width < 0 || height < 0 || dataStart < 0
+        || size < (size_t)dataStart + (size_t)scanlineSize * height)
+        {
+            unmap();
+            throw FileException(filename, "File is not a valid bitmap.");
+        }
+    }
+    /**
+     * MappedBitmap destructor releases the mapping.
+     */
+    ~MappedBitmap() {
+        unmap();
+    }
+
+    /**
+     * Gets the width of the image in pixels.
+     * @return the width of the image in pixels.
+     */
+    int getWidth() const {
+        return width;
+    }
+    /**
+     * Gets the height of the image in pixels.
+     * @return the height of the image in pixels.
+     */
+    int getHeight() const {
+        return height;
+    }
+    /**
+     * Gets the first byte of the b,g,r scanline for a row of the image.
+     * @param y the y coordinate of the row, with the origin at the top left.
+     * @return a pointer to the scanline, at least width*PIXEL_SIZE bytes long.
+     * @throws IndexOutOfBoundsException if the row is out of the image's bounds
+     */
+    const byte* getScanline(int y) const {
+        if(y < 0 || y >= height)
+        {
+            std::stringstream stream;
+            stream << "Bounds error: row " << y << ", height: " << height;
+            throw IndexOutOfBoundsException(stream.str());
+        }
+        // note that bmp format has the origin at the bottom left
+        return data + dataStart + (size_t)(height - 1 - y) * scanlineSize;
+    }
+    /**
+     * Gets the pixel at the given coordinates in the image.
+     * @param x the x coordinate of the pixel to be retrieved
+     * @param y the y coordinate of the pixel to be retrieved
+     * @return the pixel at the given coordinates
+     * @throws IndexOutOfBoundsException if the coordinates are out of the image's bounds
+     */
+    RGBPixel getRGB(int x, int y) const {
+        if(x < 0 || x >= width)
+        {
+            std::stringstream stream;
+            stream << "Bounds error: (" << x << "," << y
+                   << "), width: " << width << " height: " << height;
+            throw IndexOutOfBoundsException(stream.str());
+        }
+        const byte* pix = getScanline(y) + x*PIXEL_SIZE;
+        return RGBPixel(pix[2], pix[1], pix[0]);
+    }
+    /**
+     * Decodes the whole bitmap into a new RGBImage.
+     * @return a copy of the image that can be modified.
+     */
+    RGBImage decode() const {
+        RGBImage image(width, height, false);
+        PixelRows<RGBPixel> rows = image.getRows();
+        parallelForRows(width, height, [&](int begin, int end) {
+            for(int y = begin; y < end; y++)
+            {
+                decodeScanline(getScanline(y), rows[y].data(), width);
+            }
+        });
+        return image;
+    }
+};
+
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "ImageFilter.h"
+#include "ScanlineFilter.h"
+#include "ThreadPool.h"
+
+namespace IManip {
+
+/** the number of pixels a FusedPixelFilter pushes through all of its filters at once */
+const int FUSED_CHUNK_SIZE = 1024;
+
+/**
+ * PixelFilter is the base abstract class for filters that are pointwise:
+ * every pixel of the output depends only on the pixel at the same position in
+ * the source. Any user defined pointwise filter should inherit from
+ * PixelFilter and override filterPixels(const RGBPixel*, RGBPixel*, int). The
+ * whole image, mapped bitmap and scanline versions of the filter are all built
+ * from that, and runs of PixelFilters can be fused into a single pass with
+ * FusedPixelFilter.
+ */
+class PixelFilter : public ImageFilter, public ScanlineFilter {
+public:
+    /**
+     * Filters a run of pixels. The source and destination may be the same
+     * pixels, in which case the run is filtered in place. Whole images are
+     * filtered in bands of rows on several threads at once, so this must be
+     * safe to call concurrently on different pixels.
+     * @param src the first of the source pixels
+     * @param dest the first of the pixels to write the filtered pixels to
+     * @param count the number of pixels in the run
+     */
+    virtual void filterPixels(const RGBPixel* src, RGBPixel* dest, int count) = 0;
+    /**
+     * Composes this filter with the one that follows it into a single filter,
+     * if the two know how to combine. By default filters don't combine.
+     * @param next the filter applied after this one
+     * @return a filter with the effect of this one followed by next, or null
+     *         if they can't be combined
+     */
+    virtual std::shared_ptr<PixelFilter> composeWith(const PixelFilter&) const {
+        return std::shared_ptr<PixelFilter>();
+    }
+
+    /**
+     * Filters every row of the image with filterPixels, in bands of rows
+     * spread over the shared thread pool.
+     * @param srcImg the base image used in the transformation
+     * @return a filtered version of the image, not the original image.
+     */
+    virtual RGBImage filter(const RGBImage& srcImg) {
+        RGBImage filteredImage(srcImg.getWidth(), srcImg.getHeight(), false);
+        PixelRows<const RGBPixel> srcRows = srcImg.getRows();
+        PixelRows<RGBPixel> filteredRows = filteredImage.getRows();
+        parallelForRows(srcImg.getWidth(), srcImg.getHeight(), [&](int begin, int end) {
+            for(int y = begin; y < end; y++)
+            {
+                filterPixels(srcRows[y].data(), filteredRows[y].data(), srcImg.getWidth());
+            }
+        });
+        return filteredImage;
+    }
+    /**
+     * Filters every row of the image over the top of itself with
+     * filterPixels, in bands of rows spread over the shared thread pool.
+     * @param img the image to filter, which is changed
+     * @return true, since pointwise filters can always work in place
+     */
+    virtual bool filterInPlace(RGBImage& img) {
+        PixelRows<RGBPixel> rows = img.getRows();
+        parallelForRows(img.getWidth(), img.getHeight(), [&](int begin, int end) {
+            for(int y = begin; y < end; y++)
+            {
+                RGBPixel* row = rows[y].data();
+                filterPixels(row, row, img.getWidth());
+            }
+        });
+        return true;
+    }
+    /**
+     * Filters a mapped bitmap a row at a time. Each scanline is decoded
+     * straight into the filtered image and then filtered in place, while it is
+     * still in cache. Bands of rows are spread over the shared thread pool.
+     * @param srcImg the mapped bitmap used in the transformation
+     * @return a filtered version of the image.
+     */
+    virtual RGBImage filterMapped(const MappedBitmap& srcImg) {
+        RGBImage filteredImage(srcImg.getWidth(), srcImg.getHeight(), false);
+        PixelRows<RGBPixel> filteredRows = filteredImage.getRows();
+        parallelForRows(srcImg.getWidth(), srcImg.getHeight(), [&](int begin, int end) {
+            for(int y = begin; y < end; y++)
+            {
+                RGBPixel* filteredRow = filteredRows[y].data();
+                decodeScanline(srcImg.getScanline(y), filteredRow, srcImg.getWidth());
+                filterPixels(filteredRow, filteredRow, srcImg.getWidth());
+            }
+        });
+        return filteredImage;
+    }
+    /**
+     * Filters a single row of an image that is being streamed.
+     * @param y the y coordinate of the source row
+     * @param row the first of the source row's pixels
+     * @param width the width of the source image
+     * @param height the height of the source image
+     * @param sink where the filtered row is handed on to
+     */
+    virtual void filterScanline(int y, const RGBPixel* row, int width, int,
+                                ScanlineSink& sink) {
+        RGBPixel* filteredRow = getScanlineBuffer(width);
+        filterPixels(row, filteredRow, width);
+        sink.putScanline(y, filteredRow);
+    }
+};
+
+/**
+ * FusedPixelFilter applies a sequence of PixelFilters in a single pass over
+ * an image. The pixels are pushed through every filter a small chunk at a
+ * time, so each pixel is read from memory once and written once no matter how
+ * many filters there are.
+ */
+class FusedPixelFilter : public PixelFilter {
+private:
+    /** the filters to apply, in order */
+    std::vector<std::shared_ptr<PixelFilter> > filters;
+public:
+    /**
+     * Creates a filter that applies all of the given filters in order. Any
+     * neighbouring filters that can be composed into one are, so they cost a
+     * single filter.
+     * @param filters the filters to fuse, in the order they are applied
+     */
+    FusedPixelFilter(const std::vector<std::shared_ptr<PixelFilter> >& filters) {
+        for(int i = 0; i < filters.size(); i++)
+        {
+            std::shared_ptr<PixelFilter> composed;
+            if(!this->filters.empty())
+            {
+                composed = this->filters.back()->composeWith(*filters[i]);
+            }
+            if(composed)
+            {
+                this->filters.back() = composed;
+            }
+            else
+            {
+                this->filters.push_back(filters[i]);
+            }
+        }
+    }
+
+    /**
+     * Pushes each chunk of the run through every filter in turn. The first
+     * filter writes the chunk to the destination and the rest filter it there
+     * in place, while it is still in cache.
+     * @param src the first of the source pixels
+     * @param dest the first of the pixels to write the filtered pixels to
+     * @param count the number of pixels in the run
+     */
+    virtual void filterPixels(const RGBPixel* src, RGBPixel* dest, int count) {
+        if(filters.empty())
+        {
+            std::copy(src, src + count, dest);
+            return;
+        }
+        for(int start = 0; start < count; start += FUSED_CHUNK_SIZE)
+        {
+            int chunk = std::min(FUSED_CHUNK_SIZE, count - start);
+            filters[0]->filterPixels(src + start, dest + start, chunk);
+            for(int i = 1; i < filters.size(); i++)
+            {
+                filters[i]->filterPixels(dest + start, dest + start, chunk);
+            }
+        }
+    }
+};
+
+}
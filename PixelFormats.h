@@ -0,0 +1,416 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "ColorCurve.h"
+#include "Exceptions.h"
+#include "GeometricFilter.h"
+#include "MappedBitmap.h"
+#include "PixelImage.h"
+#include "RGBImage.h"
+#include "RGBPixel.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+namespace IManip {
+
+/**
+ * An 8-bit gray pixel, for images with no color such as document scans.
+ */
+struct Gray8 {
+    /** the brightness of the pixel */
+    byte v;
+
+    Gray8() : v(0) { }
+    explicit Gray8(byte v) : v(v) { }
+};
+
+/** A packed 24-bit pixel, the same as the pixels of an RGBImage. */
+typedef RGBPixel RGB24;
+
+/**
+ * A 32-bit pixel with an unused fourth byte, so that every pixel starts on a
+ * 4 byte boundary and can be moved or changed as a single 32-bit lane.
+ */
+struct RGBX32 {
+    byte r; /// red color value of the pixel
+    byte g; /// green color value of the pixel
+    byte b; /// blue color value of the pixel
+    byte x; /// padding, always 0
+
+    RGBX32() : r(0), g(0), b(0), x(0) { }
+    RGBX32(byte r, byte g, byte b) : r(r), g(g), b(b), x(0) { }
+};
+
+/**
+ * A 32-bit pixel with an alpha channel. Filters change the color channels
+ * and leave the alpha alone.
+ */
+struct RGBA32 {
+    byte r; /// red color value of the pixel
+    byte g; /// green color value of the pixel
+    byte b; /// blue color value of the pixel
+    byte a; /// opacity of the pixel, BYTE_MAX for fully opaque
+
+    RGBA32() : r(0), g(0), b(0), a(BYTE_MAX) { }
+    RGBA32(byte r, byte g, byte b, byte a = BYTE_MAX) : r(r), g(g), b(b), a(a) { }
+};
+
+static_assert(sizeof(Gray8) == 1, "Gray8 must be exactly 1 byte");
+static_assert(sizeof(RGBX32) == 4 && sizeof(RGBA32) == 4, "32-bit pixels must be exactly 4 bytes");
+
+/**
+ * Gets the gray level of a color, weighting the channels by how bright they
+ * look (the BT.601 luma weights, in 8-bit fixed point).
+ * @param r the red value
+ * @param g the green value
+ * @param b the blue value
+ * @return the gray level of the color
+ */
+inline byte grayLevel(byte r, byte g, byte b) {
+    return (77*r + 150*g + 29*b + 128) >> 8;
+}
+
+/**
+ * Inverts the color channels of a run of 32-bit pixels a whole pixel at a
+ * time, by xoring each one with a mask that covers all but the fourth byte.
+ * @param pixels the first of the pixels, 4 bytes each
+ * @param count the number of pixels
+ */
+inline void invertColorLanes(byte* pixels, int count) {
+    const byte colorBytes[4] = { BYTE_MAX, BYTE_MAX, BYTE_MAX, 0 };
+    uint32_t mask;
+    std::memcpy(&mask, colorBytes, sizeof(mask));
+    for(int i = 0; i < count; i++)
+    {
+        uint32_t lane;
+        std::memcpy(&lane, pixels + i*sizeof(lane), sizeof(lane));
+        lane ^= mask;
+        std::memcpy(pixels + i*sizeof(lane), &lane, sizeof(lane));
+    }
+}
+
+/**
+ * Runs the r, g and b channels of a run of pixels through a curve, leaving
+ * any other channels alone.
+ * @param row the first of the pixels
+ * @param count the number of pixels
+ * @param curve the curve to apply
+ */
+template <class Pixel>
+void curveColorChannels(Pixel* row, int count, const ColorCurve& curve) {
+    for(int i = 0; i < count; i++)
+    {
+        row[i].r = curve.getCurve(0, row[i].r);
+        row[i].g = curve.getCurve(1, row[i].g);
+        row[i].b = curve.getCurve(2, row[i].b);
+    }
+}
+
+/**
+ * PixelFormat describes how a pixel type is converted to and from 24-bit
+ * color, and holds the kernels that filters run over rows of that type.
+ * Each supported type has its own specialization, so the kernels are chosen
+ * at compile time and work on whole pixels of the right size.
+ * Every specialization has:<ul>
+ * <li>static Pixel fromRGB(byte r, byte g, byte b), converting from 24-bit color</li>
+ * <li>static RGBPixel toRGB(const Pixel&), converting to 24-bit color</li>
+ * <li>static void invertRow(Pixel* row, int count), inverting the colors of a run of pixels</li>
+ * <li>static void curveRow(Pixel* row, int count, const ColorCurve&), running a run of pixels through a curve</li>
+ * </ul>
+ */
+template <class Pixel>
+struct PixelFormat;
+
+/** The 8-bit gray format. */
+template <>
+struct PixelFormat<Gray8> {
+    static Gray8 fromRGB(byte r, byte g, byte b) {
+        return Gray8(grayLevel(r, g, b));
+    }
+    static RGBPixel toRGB(const Gray8& pixel) {
+        return RGBPixel(pixel.v, pixel.v, pixel.v);
+    }
+    static void invertRow(Gray8* row, int count) {
+        invertBytes(&row->v, &row->v, count);
+    }
+    /**
+     * Gray pixels are run through the curve as a gray color, and the result
+     * is turned back to gray, so a gray image filtered by the curve matches
+     * the color image filtered by it and then turned gray.
+     */
+    static void curveRow(Gray8* row, int count, const ColorCurve& curve) {
+        byte table[CHANNEL_VALUES];
+        for(int v = 0; v < CHANNEL_VALUES; v++)
+        {
+            table[v] = grayLevel(curve.getCurve(0, v), curve.getCurve(1, v), curve.getCurve(2, v));
+        }
+        for(int i = 0; i < count; i++)
+        {
+            row[i].v = table[row[i].v];
+        }
+    }
+};
+
+/** The packed 24-bit format, which works with the RGBImage kernels. */
+template <>
+struct PixelFormat<RGBPixel> {
+    static RGBPixel fromRGB(byte r, byte g, byte b) {
+        return RGBPixel(r, g, b);
+    }
+    static RGBPixel toRGB(const RGBPixel& pixel) {
+        return pixel;
+    }
+    static void invertRow(RGBPixel* row, int count) {
+        invertBytes(&row->r, &row->r, (size_t)count*PIXEL_SIZE);
+    }
+    static void curveRow(RGBPixel* row, int count, const ColorCurve& curve) {
+        curveColorChannels(row, count, curve);
+    }
+};
+
+/** The 32-bit format with padding, whose kernels work on whole 32-bit lanes. */
+template <>
+struct PixelFormat<RGBX32> {
+    static RGBX32 fromRGB(byte r, byte g, byte b) {
+        return RGBX32(r, g, b);
+    }
+    static RGBPixel toRGB(const RGBX32& pixel) {
+        return RGBPixel(pixel.r, pixel.g, pixel.b);
+    }
+    static void invertRow(RGBX32* row, int count) {
+        invertColorLanes(&row->r, count);
+    }
+    static void curveRow(RGBX32* row, int count, const ColorCurve& curve) {
+        curveColorChannels(row, count, curve);
+    }
+};
+
+/** The 32-bit format with alpha, whose kernels work on whole 32-bit lanes. */
+template <>
+struct PixelFormat<RGBA32> {
+    static RGBA32 fromRGB(byte r, byte g, byte b) {
+        return RGBA32(r, g, b);
+    }
+    static RGBPixel toRGB(const RGBA32& pixel) {
+        return RGBPixel(pixel.r, pixel.g, pixel.b);
+    }
+    static void invertRow(RGBA32* row, int count) {
+        invertColorLanes(&row->r, count);
+    }
+    static void curveRow(RGBA32* row, int count, const ColorCurve& curve) {
+        curveColorChannels(row, count, curve);
+    }
+};
+
+/** An image of 32-bit pixels with padding. */
+typedef PixelImage<RGBX32> RGBX32Image;
+/** An image of 32-bit pixels with alpha. */
+typedef PixelImage<RGBA32> RGBA32Image;
+
+/**
+ * Converts an RGBImage into an image of another format. The filter hierarchy
+ * works on RGBImage, and an image of another format is filtered with the
+ * kernels of its format through invertImage, curveImage and remapPixelImage,
+ * which take the same curves and remaps as the 24-bit filters.
+ * @param srcImg the image to convert
+ * @return a copy of the image in the given format
+ */
+template <class Pixel>
+PixelImage<Pixel> fromRGBImage(const RGBImage& srcImg) {
+    PixelImage<Pixel> img(srcImg.getWidth(), srcImg.getHeight(), false);
+    PixelRows<const RGBPixel> srcRows = srcImg.getRows();
+    PixelRows<Pixel> destRows = img.getRows();
+    parallelForRows(img.getWidth(), img.getHeight(), [&](int begin, int end) {
+        for(int y = begin; y < end; y++)
+        {
+            PixelSpan<const RGBPixel> src = srcRows[y];
+            PixelSpan<Pixel> dest = destRows[y];
+            for(int x = 0; x < src.size(); x++)
+            {
+                dest[x] = PixelFormat<Pixel>::fromRGB(src[x].r, src[x].g, src[x].b);
+            }
+        }
+    });
+    return img;
+}
+/**
+ * Converts an image of any format into a 24-bit RGBImage, dropping any alpha.
+ * @param srcImg the image to convert
+ * @return a 24-bit copy of the image
+ */
+template <class Pixel>
+RGBImage toRGBImage(const PixelImage<Pixel>& srcImg) {
+    RGBImage rgbImage(srcImg.getWidth(), srcImg.getHeight(), false);
+    PixelRows<const Pixel> srcRows = srcImg.getRows();
+    PixelRows<RGBPixel> destRows = rgbImage.getRows();
+    parallelForRows(rgbImage.getWidth(), rgbImage.getHeight(), [&](int begin, int end) {
+        for(int y = begin; y < end; y++)
+        {
+            PixelSpan<const Pixel> src = srcRows[y];
+            PixelSpan<RGBPixel> dest = destRows[y];
+            for(int x = 0; x < src.size(); x++)
+            {
+                dest[x] = PixelFormat<Pixel>::toRGB(src[x]);
+            }
+        }
+    });
+    return rgbImage;
+}
+
+/**
+ * Decodes a mapped bitmap straight into an image of the given format,
+ * without going through an RGBImage. Bands of rows are decoded on the shared
+ * thread pool.
+ * @param srcImg the mapped bitmap to decode
+ * @return the decoded image
+ */
+template <class Pixel>
+PixelImage<Pixel> decodePixelImage(const MappedBitmap& srcImg) {
+    PixelImage<Pixel> img(srcImg.getWidth(), srcImg.getHeight(), false);
+    PixelRows<Pixel> rows = img.getRows();
+    parallelForRows(img.getWidth(), img.getHeight(), [&](int begin, int end) {
+        for(int y = begin; y < end; y++)
+        {
+            const byte* src = srcImg.getScanline(y);
+            PixelSpan<Pixel> dest = rows[y];
+            // bitmap pixels are stored b,g,r
+            for(int x = 0; x < dest.size(); x++)
+            {
+                dest[x] = PixelFormat<Pixel>::fromRGB(src[x*PIXEL_SIZE + 2], src[x*PIXEL_SIZE + 1], src[x*PIXEL_SIZE]);
+            }
+        }
+    });
+    return img;
+}
+/**
+ * Loads a bitmap file straight into an image of the given format.
+ * @param filename the name of the bitmap file to load
+ * @return the loaded image
+ * @throws FileException if the file does not exist, is not a bitmap, or is corrupt.
+ */
+template <class Pixel>
+PixelImage<Pixel> loadPixelImage(const std::string& filename) {
+    MappedBitmap bitmap(filename);
+    return decodePixelImage<Pixel>(bitmap);
+}
+/**
+ * Saves an image of any format as a 24-bit bitmap, dropping any alpha. Each
+ * row is converted to 24-bit color and encoded through a single scanline
+ * buffer, so no 24-bit copy of the whole image is made.
+ * @param filename the name of the file to write to
+ * @param srcImg the image to save
+ * @throws FileException if the file cannot be written
+ */
+template <class Pixel>
+void savePixelImage(const std::string& filename, const PixelImage<Pixel>& srcImg) {
+    std::ofstream ofs;
+    ofs.open(filename.c_str(), std::ios::out | std::ios::binary);
+
+    byte header[DATA_START_INDEX];
+    fillHeader(header, srcImg.getWidth(), srcImg.getHeight());
+    ofs.write(reinterpret_cast<const char*>(header), DATA_START_INDEX);
+
+    // note that bmp format has the origin at the bottom left. The padding
+    // bytes of the scanline are never written to so they stay zero.
+    int scanlineSize = srcImg.getWidth()*PIXEL_SIZE + getScanlinePadding(srcImg.getWidth());
+    std::vector<RGBPixel> row(std::max(1, srcImg.getWidth()));
+    std::vector<byte> scanline(std::max(1, scanlineSize), 0);
+    PixelRows<const Pixel> srcRows = srcImg.getRows();
+    for(int y = srcImg.getHeight() - 1; y >= 0 && ofs; y--)
+    {
+        PixelSpan<const Pixel> src = srcRows[y];
+        for(int x = 0; x < src.size(); x++)
+        {
+            row[x] = PixelFormat<Pixel>::toRGB(src[x]);
+        }
+        encodeScanline(&row[0], &scanline[0], src.size());
+        ofs.write(reinterpret_cast<const char*>(&scanline[0]), scanlineSize);
+    }
+
+    ofs.close();
+    if(!ofs)
+    {
+        throw FileException(filename, "File cannot be written");
+    }
+}
+
+/**
+ * Inverts the colors of an image in place with the kernel of its format.
+ * Alpha is left alone.
+ * @param img the image to invert
+ */
+template <class Pixel>
+void invertImage(PixelImage<Pixel>& img) {
+    PixelRows<Pixel> rows = img.getRows();
+    parallelForRows(img.getWidth(), img.getHeight(), [&](int begin, int end) {
+        for(int y = begin; y < end; y++)
+        {
+            PixelFormat<Pixel>::invertRow(rows[y].data(), rows.getWidth());
+        }
+    });
+}
+/**
+ * Runs an image through a ColorCurve, such as a ColorAmplifier,
+ * GammaCorrector or LevelsAdjuster, in place with the kernel of its format.
+ * @param img the image to change
+ * @param curve the curve to apply
+ */
+template <class Pixel>
+void curveImage(PixelImage<Pixel>& img, const ColorCurve& curve) {
+    PixelRows<Pixel> rows = img.getRows();
+    parallelForRows(img.getWidth(), img.getHeight(), [&](int begin, int end) {
+        for(int y = begin; y < end; y++)
+        {
+            PixelFormat<Pixel>::curveRow(rows[y].data(), rows.getWidth(), curve);
+        }
+    });
+}
+/**
+ * Applies a remap from a GeometricFilter, such as a rotation, reflection or
+ * crop, to an image of any format. Pixels are gathered in blocks of
+ * REMAP_BLOCK_SIZE rows and columns so both images stay in cache, and whole
+ * pixels are moved, a single 32-bit lane each for the 32-bit formats.
+ * @param srcImg the source image
+ * @param remap the remap to apply, which must fit the source image
+ * @return the remapped image
+ * @throws IllegalArgumentException if a remapped dimension is negative
+ * @throws IndexOutOfBoundsException if the remap reaches outside the source
+ */
+template <class Pixel>
+PixelImage<Pixel> remapPixelImage(const PixelImage<Pixel>& srcImg, const PixelRemap& remap) {
+    remap.assertValid(srcImg.getWidth(), srcImg.getHeight());
+    PixelImage<Pixel> remappedImage(remap.width, remap.height, false);
+    if(remap.width == 0 || remap.height == 0)
+    {
+        return remappedImage;
+    }
+    PixelRows<const Pixel> srcRows = srcImg.getRows();
+    PixelRows<Pixel> destRows = remappedImage.getRows();
+    const Pixel* srcPixels = srcRows[0].data();
+    std::ptrdiff_t step = (std::ptrdiff_t)remap.xStepY*srcImg.getStride() + remap.xStepX;
+
+    parallelFor(0, remap.height, REMAP_BLOCK_SIZE, [&](int begin, int end) {
+        for(int blockX = 0; blockX < remap.width; blockX += REMAP_BLOCK_SIZE)
+        {
+            int blockEnd = std::min(remap.width, blockX + REMAP_BLOCK_SIZE);
+            for(int y = begin; y < end; y++)
+            {
+                const Pixel* src = srcPixels
+                        + (std::ptrdiff_t)(remap.y0 + y*remap.yStepY)*srcImg.getStride()
+                        + (remap.x0 + y*remap.yStepX) + blockX*step;
+                Pixel* dest = destRows[y].data();
+                for(int x = blockX; x < blockEnd; x++, src += step)
+                {
+                    dest[x] = *src;
+                }
+            }
+        }
+    });
+    return remappedImage;
+}
+
+}
@@ -0,0 +1,438 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include "BufferPool.h"
+#include "Exceptions.h"
+#include "PixelSpan.h"
+
+namespace IManip {
+
+/**
+ * Row strides of pixels whose size doesn't divide BUFFER_ALIGNMENT, such as
+ * 24-bit pixels, are rounded up to a multiple of this many pixels. 16 24-bit
+ * pixels is 48 bytes, so every row of an aligned buffer starts on a 16 byte
+ * boundary.
+ */
+const int ROW_ALIGNMENT = 16;
+
+/**
+ * Gets the number of pixels between the starts of two consecutive rows in the
+ * buffer of an image with the given width. Rows of pixels whose size divides
+ * BUFFER_ALIGNMENT, such as 8 and 32-bit pixels, are rounded up to a whole
+ * number of BUFFER_ALIGNMENT bytes, so every row starts on a cache line.
+ * Other rows are rounded up to a multiple of ROW_ALIGNMENT pixels.
+ * @param width the width of the image in pixels
+ * @return the row stride in pixels, never less than the width
+ */
+template <class Pixel>
+int getRowStride(int width) {
+    int alignment = BUFFER_ALIGNMENT % sizeof(Pixel) == 0 ? BUFFER_ALIGNMENT / (int)sizeof(Pixel) : ROW_ALIGNMENT;
+    return (width + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * Allocates a buffer of pixels whose first pixel is aligned to
+ * BUFFER_ALIGNMENT, from the shared buffer pool. The buffer must be released
+ * with freePixels, which hands it back to the pool to be reused.
+ * @param count the number of pixels in the buffer
+ * @param zeroed whether the pixels must start out as all zero bytes. Leave it
+ *        false only when every pixel will be written before it is read.
+ * @return a pointer to the first pixel of the buffer
+ */
+template <class Pixel>
+Pixel* allocatePixels(size_t count, bool zeroed = true) {
+    return static_cast<Pixel*>(getBufferPool().allocate(count * sizeof(Pixel), zeroed));
+}
+/**
+ * Releases a buffer of pixels allocated by allocatePixels.
+ * @param pixels the buffer to release, may be null
+ */
+template <class Pixel>
+void freePixels(Pixel* pixels) {
+    getBufferPool().release(pixels);
+}
+
+/**
+ * Throws the exception for an access outside the bounds of an image. Building
+ * the message is kept out of line and marked cold, so the bounds checks in
+ * pixel accessors stay as small as a compare and a branch.
+ * @param x the x coordinate that was accessed
+ * @param y the y coordinate that was accessed
+ * @param width the width of the image
+ * @param height the height of the image
+ * @throws IndexOutOfBoundsException always
+ */
+IMANIP_COLD
+void throwBoundsError(int x, int y, int width, int height) {
+    std::stringstream stream;
+    // with the default constructor, bounds can be 0. This is to allow
+    // easier initialization before assignment or reading in.
+    if(width == 0 || height == 0)
+    {
+        stream << "Image not properly intiialized: bounds of 0. widt:h"
+               << width << " height: " << height;
+    }
+    else
+    {
+        stream << "Bounds error: (" << x << "," << y
+               << "), width: " << width << " height: " << height;
+    }
+    throw IndexOutOfBoundsException(stream.str());
+}
+
+/**
+ * PixelImage is the storage of every image, whatever its pixel format: an
+ * RGBImage is a PixelImage of 24-bit pixels, and a ChannelImage one of 8-bit
+ * pixels (see PixelFormats.h for the formats and the kernels that work on them).
+ * Pixels are stored row-major: each row is a contiguous run of width pixels,
+ * and consecutive rows are getStride() pixels apart, in a buffer from the
+ * shared buffer pool. Whole rows may be accessed directly with getRow(int) or
+ * getRows(), or individual pixels with coordinates. The size of the image is
+ * immutable once created.
+ *
+ * A PixelImage is a view of a pixel buffer that can be shared with other
+ * images. Copying an image, or taking a subImage of one, only shares the
+ * buffer, so it costs nothing however large the image is. The first time a
+ * shared image is written to, through the non-const getRow(int), getRows() or
+ * setPixel(int, int, Pixel), it copies its own pixels into a buffer of its
+ * own, so writing to an image never changes any other. A row pointer from the
+ * non-const getRow(int) should not be written through after the image has
+ * been copied.
+ */
+template <class Pixel>
+class PixelImage {
+private:
+    /** the pixel buffer, which may be shared with other images */
+    std::shared_ptr<Pixel> buffer;
+    /** the top left pixel of this image within the buffer, then height rows of stride pixels each */
+    Pixel* image;
+    /** the image width in pixels */
+    int width;
+    /** the image height in pixels */
+    int height;
+    /** the number of pixels between the starts of consecutive rows */
+    int stride;
+
+    /**
+     * Checks if the given coordinates are within the bounds of the image, and
+     * throws an exception if they are not.
+     * @param x the x coordinate to check.
+     * @param y the y coordinate to check.
+     * @throws IndexOutOfBoundsException if the point is outside of the bounds
+     */
+    void assertBounds(int x, int y) const {
+        if(x < 0
+        || x >= width
+        || y < 0
+        || y >= height)
+        {
+            throwBoundsError(x, y, width, height);
+        }
+    }
+    /**
+     * Checks if the given row is within the bounds of the image, and throws an
+     * exception if it is not. Unlike assertBounds, a row of an image with a
+     * width of 0 is still considered in bounds.
+     * @param y the y coordinate of the row to check.
+     * @throws IndexOutOfBoundsException if the row is outside of the bounds
+     */
+    void assertRow(int y) const {
+        if(y < 0 || y >= height)
+        {
+            assertBounds(0, y);
+        }
+    }
+protected:
+    /**
+     * Initializes the data members of this image to the given width and
+     * height, with a buffer of its own.
+     * @param width the width in pixels, must be non-negative
+     * @param height the height in pixels, must be non-negative
+     * @param zeroed whether the pixels must start out as all zero bytes
+     * @throws IllegalArgumentException if either dimension is negative
+     */
+    void initializeWith(int width, int height, bool zeroed = true) {
+        // ensure that the dimensions are greater than zero
+        if(width < 0 || height < 0)
+        {
+            std::stringstream stream;
+            stream << "Dimensions must be greater than zero. Width: "
+                   << width << " Height: " << height << "\n";
+            throw IllegalArgumentException(stream.str());
+        }
+        this->width = width;
+        this->height = height;
+        this->stride = getRowStride<Pixel>(width);
+
+        // heap allocated, aligned rows to store image data
+        this->buffer.reset(allocatePixels<Pixel>((size_t)stride*height, zeroed), freePixels<Pixel>);
+        this->image = this->buffer.get();
+    }
+public:
+    /**
+     * Creates an image of the given size, and may leave the pixels
+     * uninitialized. Filters that write every pixel of the image they return
+     * use this to skip clearing a buffer they are about to overwrite, which
+     * matters most when the buffer is recycled from the pool and already
+     * paged in.
+     * @param width the width of the image in pixels
+     * @param height the height of the image in pixels
+     * @param zeroed whether the pixels must start out as all zero bytes.
+     *        Leave it false only when every pixel will be written before it is read.
+     * @throws IllegalArgumentException if either dimension is negative
+     */
+    PixelImage(int width, int height, bool zeroed = true) {
+        initializeWith(width, height, zeroed);
+    }
+    /**
+     * Copy constructor. The copy shares the old image's pixels until either
+     * of them is written to.
+     * @param srcImg the image whose data will be copied.
+     */
+    PixelImage(const PixelImage& srcImg)
+        : buffer(srcImg.buffer), image(srcImg.image),
+          width(srcImg.width), height(srcImg.height), stride(srcImg.stride) { }
+    /**
+     * Move constructor. Takes over the pixel data of the old image without
+     * copying it, leaving the old image with no pixels.
+     * @param srcImg the image whose data will be taken.
+     */
+    PixelImage(PixelImage&& srcImg)
+        : buffer(std::move(srcImg.buffer)), image(srcImg.image),
+          width(srcImg.width), height(srcImg.height), stride(srcImg.stride) {
+        srcImg.image = 0;
+        srcImg.width = 0;
+        srcImg.height = 0;
+        srcImg.stride = 0;
+    }
+    /**
+     * Default constructor takes no arguments and initializes an image with no
+     * pixels. Convenience constructor for immediate assignment or read in.
+     */
+    PixelImage() : image(0), width(0), height(0), stride(0) { }
+    /**
+     * Assignment operator makes this image share the source image's pixels
+     * until either of them is written to. This image's old pixels are released
+     * once no other image shares them.
+     * @param srcImg the image whose data will be copied.
+     * @return a reference to this.
+     */
+    PixelImage& operator=(const PixelImage& srcImg) {
+        buffer = srcImg.buffer;
+        image = srcImg.image;
+        width = srcImg.width;
+        height = srcImg.height;
+        stride = srcImg.stride;
+        return *this;
+    }
+    /**
+     * Move assignment operator releases this image's pixel data and takes over
+     * that of the source image without copying it. The source image is left
+     * with no pixels.
+     * @param srcImg the image whose data will be taken.
+     * @return a reference to this.
+     */
+    PixelImage& operator=(PixelImage&& srcImg) {
+        if(this != &srcImg)
+        {
+            buffer = std::move(srcImg.buffer);
+            image = srcImg.image;
+            width = srcImg.width;
+            height = srcImg.height;
+            stride = srcImg.stride;
+            srcImg.buffer.reset();
+            srcImg.image = 0;
+            srcImg.width = 0;
+            srcImg.height = 0;
+            srcImg.stride = 0;
+        }
+        return *this;
+    }
+    /**
+     * Compares the dimensions and then the individual pixels of the two
+     * images. If the dimensions and pixels are equal, then the images are equal.
+     * @param img the image that this will be compared to.
+     * @return true if the images are equivalent.
+     */
+    bool operator==(const PixelImage& img) const {
+        // if the dimensions aren't equal, then the images definitely aren't
+        if( !(width == img.width && height == img.height) )
+        {
+            return false;
+        }
+
+        // If the pointers are equal, then the data definitely is, so we don't
+        // need to check explicitly.
+        if(image != img.image)
+        {
+            // compare the images a row at a time, ignoring the row padding
+            for(int y = 0; y < height; y++)
+            {
+                // if any of the rows in the images aren't equal, the images aren't
+                if(std::memcmp(image + (size_t)y*stride, img.image + (size_t)y*img.stride, width*sizeof(Pixel)) != 0)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    /**
+     * Returns the inverse of operator==.
+     * @param img the image that this will be compared to.
+     * @return true if the images are not equivalent.
+     */
+    bool operator!=(const PixelImage& img) const {
+        return !operator==(img);
+    }
+
+    /**
+     * Gets the width of the image in pixels.
+     * @return the width of the image in pixels.
+     */
+    int getWidth() const {
+        return width;
+    }
+    /**
+     * Gets the height of the image in pixels.
+     * @return the height of the image in pixels.
+     */
+    int getHeight() const {
+        return height;
+    }
+    /**
+     * Gets the number of pixels between the start of one row and the start of
+     * the next. Pixels past the width of a row are padding and are never read.
+     * @return the row stride of the image in pixels.
+     */
+    int getStride() const {
+        return stride;
+    }
+    /**
+     * Gets a pointer to the first of the width contiguous pixels in a row, to
+     * be written to. If the image shares its pixels, it gets its own copy of
+     * them first.
+     * @param y the y coordinate of the row to be retrieved
+     * @return a pointer to the leftmost pixel of the row
+     * @throws IndexOutOfBoundsException if the row is out of the image's bounds
+     */
+    Pixel* getRow(int y) {
+        assertRow(y);
+        makeUnique();
+        return image + (size_t)y*stride;
+    }
+    /**
+     * Gets a read-only pointer to the first of the width contiguous pixels in a row.
+     * @param y the y coordinate of the row to be retrieved
+     * @return a pointer to the leftmost pixel of the row
+     * @throws IndexOutOfBoundsException if the row is out of the image's bounds
+     */
+    const Pixel* getRow(int y) const {
+        assertRow(y);
+        return image + (size_t)y*stride;
+    }
+    /**
+     * Gets every row of the image to be written to, as spans that are not
+     * bounds checked. If the image shares its pixels, it gets its own copy of
+     * them first, so the rows can be handed out to several threads at once.
+     * Loops over the rows should use this rather than getRow(int) or the
+     * per-pixel accessors.
+     * @return a view of the rows of the image
+     */
+    PixelRows<Pixel> getRows() {
+        makeUnique();
+        return PixelRows<Pixel>(image, width, height, stride);
+    }
+    /**
+     * Gets every row of the image to be read, as spans that are not bounds
+     * checked.
+     * @return a read-only view of the rows of the image
+     */
+    PixelRows<const Pixel> getRows() const {
+        return PixelRows<const Pixel>(image, width, height, stride);
+    }
+    /**
+     * Gets the pixel at the given coordinates in the image.
+     * @param x the x coordinate of the pixel to be retrieved
+     * @param y the y coordinate of the pixel to be retrieved
+     * @return the pixel at the given coordinates
+     * @throws IndexOutOfBoundsException if the coordinates are out of the image's bounds
+     */
+    Pixel getPixel(int x, int y) const {
+        assertBounds(x, y);
+        return image[(size_t)y*stride + x];
+    }
+    /**
+     * Puts the pixel at the given coordinates in the image.
+     * @param x the x coordinate of the pixel to be set
+     * @param y the y coordinate of the pixel to be set
+     * @param pixel the pixel to be set.
+     * @throws IndexOutOfBoundsException if the coordinates are out of the image's bounds
+     */
+    void setPixel(int x, int y, Pixel pixel) {
+        assertBounds(x, y);
+        makeUnique();
+        image[(size_t)y*stride + x] = pixel;
+    }
+    /**
+     * Makes sure that this image's pixels are not shared with any other image
+     * before they are written to, by copying them into a buffer of its own if
+     * they are. The copy only covers this image, not the rest of the buffer.
+     * Several threads may write to different rows of an image that isn't
+     * shared, so call this before handing the rows of an image out to them.
+     */
+    void makeUnique() {
+        if(buffer && buffer.use_count() > 1)
+        {
+            PixelImage copy(width, height, false);
+            for(int y = 0; y < height; y++)
+            {
+                const Pixel* srcRow = image + (size_t)y*stride;
+                std::copy(srcRow, srcRow + width, copy.image + (size_t)y*copy.stride);
+            }
+            *this = std::move(copy);
+        }
+    }
+    /**
+     * Checks if this image shares its pixel buffer with another image, such as
+     * a copy or a subImage of it.
+     * @param img the image to check against
+     * @return true if both images view the same pixel buffer
+     */
+    bool sharesPixelsWith(const PixelImage& img) const {
+        return buffer && buffer == img.buffer;
+    }
+    /**
+     * Gets a subsection of this image. The subsection shares this image's
+     * pixels rather than copying them, so it costs nothing to take.
+     * @param xOffset the top left x coordinate to begin the read from
+     * @param yOffset the top left y coordinate to begin the read from
+     * @param width the width of the SubImage
+     * @param height the height of the SubImage
+     * @throws IndexOutOfBoundsException if the SubImage dimensions overflow those of the SrcImage
+     * @return the given SubImage
+     */
+    PixelImage subImage(int xOffset, int yOffset, int width, int height) const {
+        if( xOffset < 0 || yOffset < 0 || width < 0 || height < 0
+         || (xOffset + width  > this->width)
+         || (yOffset + height > this->height) )
+        {
+            std::stringstream stream;
+            stream << "SubImage dimensions out of bounds:\nSubImage: x: " << xOffset
+                   << " y: " << yOffset << " width: " << width << " height: "
+                   << height << "\nSrcImage: width: " << this->width
+                   << " height: " << this->height;
+            throw IndexOutOfBoundsException(stream.str());
+        }
+
+        PixelImage subImage(*this);
+        subImage.image = image + (size_t)yOffset*stride + xOffset;
+        subImage.width = width;
+        subImage.height = height;
+        return subImage;
+    }
+};
+
+}
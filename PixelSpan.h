@@ -0,0 +1,127 @@
+#pragma once
+
+#if defined(__GNUC__)
+#define IMANIP_COLD __attribute__((noinline, cold))
+#else
+#define IMANIP_COLD
+#endif
+
+namespace IManip {
+
+/**
+ * PixelSpan is a contiguous run of pixels, such as one row of an image, that
+ * can be indexed and iterated over without any bounds checks. The image it
+ * came from checks the row once when the span is made, so loops over a span
+ * are plain pointer loops that the compiler is free to vectorize.
+ * A span is only valid for as long as the image it views is not resized,
+ * reassigned or copied and then written to.
+ */
+template <class Pixel>
+class PixelSpan {
+private:
+    /** the first pixel of the run */
+    Pixel* first;
+    /** the number of pixels in the run */
+    int count;
+public:
+    /**
+     * Creates a span over a run of pixels.
+     * @param first the first pixel of the run
+     * @param count the number of pixels in the run
+     */
+    PixelSpan(Pixel* first, int count) : first(first), count(count) { }
+
+    /**
+     * Gets the first pixel of the span.
+     * @return a pointer to the first pixel
+     */
+    Pixel* begin() const {
+        return first;
+    }
+    /**
+     * Gets the end of the span.
+     * @return a pointer one past the last pixel
+     */
+    Pixel* end() const {
+        return first + count;
+    }
+    /**
+     * Gets the first pixel of the span.
+     * @return a pointer to the first pixel
+     */
+    Pixel* data() const {
+        return first;
+    }
+    /**
+     * Gets the number of pixels in the span.
+     * @return the number of pixels
+     */
+    int size() const {
+        return count;
+    }
+    /**
+     * Gets a pixel of the span, without checking the index.
+     * @param x the index of the pixel, from 0 to size() - 1
+     * @return a reference to the pixel
+     */
+    Pixel& operator[](int x) const {
+        return first[x];
+    }
+};
+
+/**
+ * PixelRows is a view of every row of an image that hands out rows as
+ * PixelSpans without any bounds checks. Getting the rows of an image checks
+ * it once, and gives an image that shares its pixels a copy of its own before
+ * handing out rows to write to, so the rows can then be read and written from
+ * any number of threads at no further cost.
+ * The view is only valid for as long as the image it came from is not
+ * resized, reassigned or copied and then written to.
+ */
+template <class Pixel>
+class PixelRows {
+private:
+    /** the first pixel of the top row */
+    Pixel* origin;
+    /** the number of pixels in each row */
+    int width;
+    /** the number of rows */
+    int height;
+    /** the number of pixels between the starts of consecutive rows */
+    int stride;
+public:
+    /**
+     * Creates a view of the rows of an image.
+     * @param origin the first pixel of the top row
+     * @param width the number of pixels in each row
+     * @param height the number of rows
+     * @param stride the number of pixels between the starts of consecutive rows
+     */
+    PixelRows(Pixel* origin, int width, int height, int stride)
+        : origin(origin), width(width), height(height), stride(stride) { }
+
+    /**
+     * Gets the number of pixels in each row.
+     * @return the width of the image in pixels
+     */
+    int getWidth() const {
+        return width;
+    }
+    /**
+     * Gets the number of rows.
+     * @return the height of the image in pixels
+     */
+    int getHeight() const {
+        return height;
+    }
+    /**
+     * Gets a row of the image, without checking the index.
+     * @param y the y coordinate of the row, from 0 to getHeight() - 1
+     * @return the width pixels of the row
+     */
+    PixelSpan<Pixel> operator[](int y) const {
+        return PixelSpan<Pixel>(origin + (size_t)y*stride, width);
+    }
+};
+
+}
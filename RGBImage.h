@@ -2,7 +2,13 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include <cstring>
+#include <memory>
+#include <algorithm>
 #include "Exceptions.h"
+#include "PixelImage.h"
+#include "PixelSpan.h"
 #include "RGBPixel.h"
 
 namespace IManip {
@@ -30,54 +36,52 @@ const int PIXEL_SIZE = 3; /// size in bytes of a pixel
 const short BIT_DEPTH = PIXEL_SIZE*BYTE_BIT; /// all of our images are 24 bit (3 byte) pixels
 const int IMAGE_SIZE_INDEX = 34; /// index where image size (not including header) is found
 
-/* fstream can only read in or write out one char at a time. That limitation
- * makes reading and writing anything larger than a byte a bit of a pain to do.
- * These functions allow for easier read/write to a specific position.
+/** the number of bytes of pixel data read from a file in one go */
+const int DECODE_BATCH_SIZE = 1 << 22;
+/** the number of bytes of pixel data written to a file in one go */
+const int ENCODE_BATCH_SIZE = 1 << 22;
+
+/* The bitmap header is read and written in one go through a byte buffer, and
+ * the multi-byte values in it are stored little endian, a byte at a time.
+ * These functions allow for easier read/write to a specific position in that
+ * buffer.
  *
  * They're a bit of black magic. If you want to know how they work, track me
  * down and I'll explain it to you. Otherwise, don't feel pressured to understand
  * why they work and trust that they do.
  */
-int getInt(std::ifstream& ifs, int offset) {
-    ifs.seekg(offset);
-
+int readInt(const byte* header, int offset) {
     int result = 0;
 
     for(int i = 0; i < sizeof(int); i++)
     {
-        // bit shift each character by the number of bytes * byte bitwidth
-        result += ifs.get()<<(i * BYTE_BIT);
+        // bit shift each byte by the number of bytes * byte bitwidth
+        result |= header[offset + i]<<(i * BYTE_BIT);
     }
 
     return result;
 }
-void putInt(std::ofstream& ofs, int offset, int val) {
-    ofs.seekp(offset);
-
+void writeInt(byte* header, int offset, int val) {
     for(int i = 0; i < sizeof(int); i++)
     {
-        ofs.put(val>>(i*BYTE_BIT) % (BYTE_MAX + 1));
+        header[offset + i] = val>>(i*BYTE_BIT) % (BYTE_MAX + 1);
     }
 }
-short getShort(std::ifstream& ifs, int offset) {
-    ifs.seekg(offset);
-
+short readShort(const byte* header, int offset) {
     short result = 0;
 
     for(int i = 0; i < sizeof(short); i++)
     {
-        // bit shift each character by the number of bytes * byte bitwidth
-        result += ifs.get()<<(i * BYTE_BIT);
+        // bit shift each byte by the number of bytes * byte bitwidth
+        result |= header[offset + i]<<(i * BYTE_BIT);
     }
 
     return result;
 }
-void putShort(std::ofstream& ofs, int offset, short val) {
-    ofs.seekp(offset);
-
+void writeShort(byte* header, int offset, short val) {
     for(int i = 0; i < sizeof(short); i++)
     {
-        ofs.put(val>>(i*BYTE_BIT) % (BYTE_MAX + 1));
+        header[offset + i] = val>>(i*BYTE_BIT) % (BYTE_MAX + 1);
     }
 }
 
@@ -104,89 +108,78 @@ int getScanlinePadding(int width) {
 }
 
 /**
- * This class is the internal representation of a 24-bit bitmap image.
- * The memory to store the image data is heap allocated.
- * Individual pixels may be accessed or modified with coordinates.
- * The size of the image is immutable once created. Create a new RGBImage
- * to "change" the size.
+ * Converts one bitmap scanline, stored b,g,r, into a row of pixels.
+ * The loop has no branches or calls so that the compiler can vectorize it.
+ * @param src the first byte of the scanline, at least width*PIXEL_SIZE bytes
+ * @param dest the row of pixels to write, at least width pixels
+ * @param width the number of pixels in the scanline
  */
-class RGBImage {
-private:
-    /** "2d array" of pixel data with dimension width*height */
-    RGBPixel* image;
-    /** the image width in pixels */
-    int width; 
-    /** the image height in pixels */
-    int height;
-    /**
-     * Checks if the given coordinates are within the bounds of the image, and
-     * throws an exception if they are not.
-     * @param x the x coordinate to check.
-     * @param y the y coordinate to check.
-     * @throws IndexOutOfBoundsException if the point is outside of the bounds
-     */
-    void assertBounds(int x, int y) const {
-        if(x < 0
-        || x >= width
-        || y < 0
-        || y >= height)
-        {
-            std::stringstream stream;
-            // with the default constructor, bounds can be 0. This is to allow
-            // easier initialization before assignment or reading in.
-            if(width == 0 || height == 0)
-            {
-                stream << "Image not properly intiialized: bounds of 0. widt:h"
-                       << width << " height: " << height;
-            }
-            else
-            {
-                stream << "Bounds error: (" << x << "," << y
-                       << "), width: " << width << " height: " << height;
-            }
-            throw IndexOutOfBoundsException(stream.str());
-        }
+void decodeScanline(const byte* src, RGBPixel* dest, int width) {
+    for(int x = 0; x < width; x++)
+    {
+        dest[x].r = src[x*PIXEL_SIZE + 2];
+        dest[x].g = src[x*PIXEL_SIZE + 1];
+        dest[x].b = src[x*PIXEL_SIZE];
     }
-    /**
-     * Initializes the data members of this RGBImage to the given width and
-     * height. The width and height must be non-negative quantities.
-     * @param width the width in pixels, must be non-negative
-     * @param height the height in pixels, must be non-negative
-     */
-    void initializeWith(int width, int height) {
-        // ensure that the dimensions are greater than zero
-        if(width < 0 || height < 0)
-        {
-            std::stringstream stream;
-            stream << "Dimensions must be greater than zero. Width: "
-                   << width << " Height: " << height << "\n";
-            throw IllegalArgumentException(stream.str());
-        }
-        this->width = width;
-        this->height = height;
+}
 
-        // heap allocated "2d array" to store image data
-        this->image = new RGBPixel[width*height];
+/**
+ * Converts a row of pixels into one bitmap scanline, stored b,g,r.
+ * The padding bytes after the scanline are left untouched.
+ * @param src the row of pixels to read, at least width pixels
+ * @param dest the first byte of the scanline, at least width*PIXEL_SIZE bytes
+ * @param width the number of pixels in the row
+ */
+void encodeScanline(const RGBPixel* src, byte* dest, int width) {
+    for(int x = 0; x < width; x++)
+    {
+        dest[x*PIXEL_SIZE]     = src[x].b;
+        dest[x*PIXEL_SIZE + 1] = src[x].g;
+        dest[x*PIXEL_SIZE + 2] = src[x].r;
     }
-    /**
-     * Initializes the data members of this RGBImage to those of the source image
-     * Note that this assumes that the image* has either not yet been allocated,
-     * or has been properly deleted.
-     * The assignment operator (operator==) should be used for general assignment.
-     * @param srcImg the image whose data will be copied.
-     */
-    void initializeTo(const RGBImage& srcImg) {
-        // copy dimensions of the source image
-        this->width = srcImg.width;
-        this->height = srcImg.height;
-
-        // copy pixel data of source image
-        this->image = new RGBPixel[width*height];
-        for(int i = 0; i < width*height; i++)
-        {
-            this->image[i] = srcImg.image[i];
-        }
+}
+
+/**
+ * Reads the dimensions and data position of a bitmap out of its header, and
+ * makes sure that they describe a valid 24-bit bitmap.
+ * @param header the start of the file, holding the header.
+ * @param headerSize the number of bytes of the file available in header.
+ * @param filename the name of the file, for any exceptions thrown.
+ * @param width set to the width of the bitmap in pixels.
+ * @param height set to the height of the bitmap in pixels.
+ * @param dataStart set to the offset of the pixel data in the file.
+ * @throws FileException if the file is not a bitmap, or its header is corrupt.
+ */
+void parseHeader(const byte* header, size_t headerSize, const std::string& filename,
+                 int& width, int& height, int& dataStart) {
+    // make sure that the file is of a valid bitmap
+    if(headerSize < (size_t)DATA_START_INDEX
+    || readShort(header, FILE_START_INDEX) != BMP_IDENTIFIER)
+    {
+        throw FileException(filename, "File is not a bitmap");
+    }
+
+    // load data about the file from the header;
+    int file_size = readInt(header, FILE_SIZE_INDEX);
+    dataStart = readInt(header, DATA_START_INDEX_INDEX);
+    width = readInt(header, WIDTH_INDEX);
+    height = readInt(header, HEIGHT_INDEX);
+
+    // validate the file header by checking the padding bytes
+    if(file_size != dataStart + (width * PIXEL_SIZE + getScanlinePadding(width)) * height)
+    {
+        throw FileException(filename, "File is not a valid bitmap.");
     }
+}
+
+/**
+ * This class is the internal representation of a 24-bit bitmap image: a
+ * PixelImage of packed 24-bit pixels, which can be loaded from and saved to a
+ * bitmap file. See PixelImage for how the pixels are stored and shared.
+ * The size of the image is immutable once created. Create a new RGBImage
+ * to "change" the size.
+ */
+class RGBImage : public PixelImage<RGBPixel> {
 public:
     /**
      * RGBImage constructor takes width and height, heap allocates image memory.
@@ -194,9 +187,17 @@ public:
      * @param height the height of the image in pixels
      * @throws IllegalArgumentException if either dimension is negative
      */
-    RGBImage(int width, int height) {
-        initializeWith(width, height);
-    }
+    RGBImage(int width, int height) : PixelImage<RGBPixel>(width, height) { }
+    /**
+     * RGBImage constructor takes width and height, and may leave the pixels
+     * uninitialized. See PixelImage(int, int, bool).
+     * @param width the width of the image in pixels
+     * @param height the height of the image in pixels
+     * @param zeroed whether the pixels must start out black. Leave it false
+     *        only when every pixel will be written before it is read.
+     * @throws IllegalArgumentException if either dimension is negative
+     */
+    RGBImage(int width, int height, bool zeroed) : PixelImage<RGBPixel>(width, height, zeroed) { }
     /**
      * RGBImage constructor takes a filename and loads the bitmap image in that file.
      * @param filename the name of the bitmap file to load for the image.
@@ -212,130 +213,47 @@ public:
             ifs.close();
             throw FileException(filename, "File cannot be read or does not exist");
         }
-        // make sure that the file opened is of a valid bitmap
-        if(getShort(ifs, FILE_START_INDEX) != BMP_IDENTIFIER)
-        {
-            ifs.close();
-            throw FileException(filename, "File is not a bitmap");
-        }
+        // read the whole header at once, then make sure that the file opened
+        // is of a valid bitmap
+        byte header[DATA_START_INDEX];
+        ifs.read(reinterpret_cast<char*>(header), DATA_START_INDEX);
+        int data_width, data_height, data_start;
+        parseHeader(header, ifs.gcount(), filename, data_width, data_height, data_start);
 
-        // load data about the file from the stream;
-        int file_size = getInt(ifs, FILE_SIZE_INDEX);
-        int data_start = getInt(ifs, DATA_START_INDEX_INDEX);
-        int data_width = getInt(ifs, WIDTH_INDEX);
-        int data_height = getInt(ifs, HEIGHT_INDEX);
+        // initialize the image, every row of which is read in below
+        initializeWith(data_width, data_height, false);
 
-        // validate the file header by checking the padding bytes
-        if(file_size != data_start + (data_width * PIXEL_SIZE + getScanlinePadding(data_width)) * data_height)
+        ifs.seekg(data_start);
+        ifs >> *this;
+
+        // the header promised more pixel data than the file holds
+        if(!ifs)
         {
             ifs.close();
             throw FileException(filename, "File is not a valid bitmap.");
         }
 
-        // initialize the image
-        initializeWith(data_width, data_height);
-
-        ifs.seekg(data_start);
-        ifs >> *this;
-
         ifs.close();
     }
     /**
-     * Copy constructor for RGBImage. Makes a deep copy of the old image.
+     * Makes an RGBImage of a PixelImage of 24-bit pixels, such as one returned
+     * by remapPixelImage. The two share their pixels until either of them is
+     * written to.
      * @param srcImg the image whose data will be copied.
      */
-    RGBImage(const RGBImage& srcImg) {
-        initializeTo(srcImg);
-    }
-    /**
-     * Default constructor takes no arguments and initializes an image with no
-     * pixels. Convenience constructor for immediate assignment or read in.
-     */
-    RGBImage() : width(0), height(0) { }
+    RGBImage(const PixelImage<RGBPixel>& srcImg) : PixelImage<RGBPixel>(srcImg) { }
     /**
-     * RGBImage destructor to release heap allocated memory
+     * Makes an RGBImage of a PixelImage of 24-bit pixels, taking over its
+     * pixel data without copying it.
+     * @param srcImg the image whose data will be taken.
      */
-    ~RGBImage() {
-        // if the image data had been heap allocated
-        if(image)
-        {
-            // delete that heap allocated data
-            delete image;
-        }
-    }
+    RGBImage(PixelImage<RGBPixel>&& srcImg) : PixelImage<RGBPixel>(std::move(srcImg)) { }
     /**
-     * Assignment operator makes a deep copy of the source image.
-     * @param srcImg the image whose data will be copied.
-     * @return a reference to this.
-     */
-    RGBImage& operator=(const RGBImage& srcImg) {
-        // We only have to do the assignment if the objects are unequal
-        // If they're already equal, then we can skip the assignment.
-        if(*this != srcImg)
-        {
-            // Call the destructor to clean up any old heap allocated image data
-            this->~RGBImage();
-            // initialize the now cleared data members to those of the source image
-            initializeTo(srcImg);
-        }
-        return *this;
-    }
-    /**
-     * Overloading of operator== compares the dimensions and then the individual
-     * pixel values of the two images. If the dimensions and pixels are equal,
-     * then the images are equal.
-     * @param img the image that this will be compared to.
-     * @return true if the images are equivalent.
-     */
-    bool operator==(const RGBImage& img) {
-        // if the dimensions aren't equal, then the images definitely aren't
-        if( !(width == img.width && height == img.height) )
-        {
-            return false;
-        }
-
-        // If the pointers are equal, then the data definitely is, so we don't
-        // need to check explicitly.
-        if(image != img.image)
-        {
-            // iterate through every pixel in the images
-            for(int i = 0; i < width*height; i++)
-            {
-                // if any of the pixels in the images aren't equal, the images aren't
-                if(image[i] != img.image[i])
-                {
-                    return false;
-                }
-            }
-        }
-
-        // finally, if the dimensions of the images are equal, and the
-        // individual pixels of the images are equal, then the images are equal
-        return true;
-    }
-    /**
-     * Overloading of operator!= returns the inverse of operator==.
-     * @param img the image that this will be compared to.
-     * @return true if the images are not equivalent.
+     * Default constructor takes no arguments and initializes an image with no
+     * pixels. Convenience constructor for immediate assignment or read in.
      */
-    bool operator!=(const RGBImage& img) {
-        return !operator==(img);
-    }
+    RGBImage() { }
 
-    /**
-     * Gets the width of the image in pixels.
-     * @return the width of the image in pixels.
-     */
-    int getWidth() const {
-        return width;
-    }
-    /**
-     * Gets the height of the image in pixels.
-     * @return the height of the image in pixels.
-     */
-    int getHeight() const {
-        return height;
-    }
     /**
      * Gets the pixel at the given coordinates in the image.
      * @param x the x coordinate of the pixel to be retrieved
@@ -344,8 +262,7 @@ public:
      * @throws IndexOutOfBoundsException if the coordinates are out of the image's bounds
      */
     RGBPixel getRGB(int x, int y) const {
-        assertBounds(x, y);
-        return image[x*height + y];
+        return getPixel(x, y);
     }
     /**
      * Puts the pixel at the given coordinates in the image.
@@ -355,41 +272,81 @@ public:
      * @throws IndexOutOfBoundsException if the coordinates are out of the image's bounds
      */
     void setRGB(int x, int y, RGBPixel pixel) {
-        assertBounds(x, y);
-        image[x*height + y] = pixel;
+        setPixel(x, y, pixel);
     }
     /**
-     * Gets a copy of a subsection of this image.
+     * Gets a subsection of this image. The subsection shares this image's
+     * pixels rather than copying them, so it costs nothing to take.
      * @param xOffset the top left x coordinate to begin the read from
      * @param yOffset the top left y coordinate to begin the read from
      * @param width the width of the SubImage
      * @param height the height of the SubImage
      * @throws IndexOutOfBoundsException if the SubImage dimensions overflow those of the SrcImage
-     * @return a copy of the given SubImage
+     * @return the given SubImage
      */
     RGBImage subImage(int xOffset, int yOffset, int width, int height) const {
-        if( (xOffset + width  > this->width)
-         || (yOffset + height > this->height) )
+        return PixelImage<RGBPixel>::subImage(xOffset, yOffset, width, height);
+    }
+};
+/**
+ * Calls a function on every pixel of an image, row by row. The image is
+ * checked once, and the loop over each row is unchecked.
+ * @param srcImg the image to read
+ * @param function called with a const reference to each pixel
+ */
+template <class Function>
+void forEachPixel(const RGBImage& srcImg, Function function) {
+    PixelRows<const RGBPixel> rows = srcImg.getRows();
+    for(int y = 0; y < rows.getHeight(); y++)
+    {
+        PixelSpan<const RGBPixel> row = rows[y];
+        for(const RGBPixel* pixel = row.begin(); pixel != row.end(); ++pixel)
         {
-            std::stringstream stream;
-            stream << "SubImage dimensions out of bounds:\nSubImage: x: " << xOffset 
-                   << " y: " << yOffset << " width: " << width << " height: " 
-                   << height << "\nSrcImage: width: " << this->width 
-                   << " height: " << this->height;
-            throw IndexOutOfBoundsException(stream.str());
+            function(*pixel);
         }
-        
-        RGBImage subImage(width, height);
-        for(int x = 0; x < width; x++)
+    }
+}
+/**
+ * Replaces every pixel of an image with a function of the matching pixel of
+ * another image. The sizes are checked once, and the loop over each row is
+ * unchecked. The two may be the same image.
+ * @param srcImg the image to read
+ * @param destImg the image to write, the same size as srcImg
+ * @param function called with each source pixel, returning the new pixel
+ * @throws IllegalArgumentException if the images are not the same size
+ */
+template <class Function>
+void transformPixels(const RGBImage& srcImg, RGBImage& destImg, Function function) {
+    if(srcImg.getWidth() != destImg.getWidth() || srcImg.getHeight() != destImg.getHeight())
+    {
+        std::stringstream stream;
+        stream << "Cannot transform a " << srcImg.getWidth() << "x" << srcImg.getHeight()
+               << " image into a " << destImg.getWidth() << "x" << destImg.getHeight() << " image";
+        throw IllegalArgumentException(stream.str());
+    }
+    // the destination goes first, since making it unique may move its pixels
+    PixelRows<RGBPixel> destRows = destImg.getRows();
+    PixelRows<const RGBPixel> srcRows = srcImg.getRows();
+    for(int y = 0; y < srcRows.getHeight(); y++)
+    {
+        PixelSpan<const RGBPixel> src = srcRows[y];
+        PixelSpan<RGBPixel> dest = destRows[y];
+        for(int x = 0; x < src.size(); x++)
         {
-            for(int y = 0; y < height; y++)
-            {
-                subImage.setRGB(x, y, getRGB(x + xOffset, y + yOffset));
-            }
+            dest[x] = function(src[x]);
         }
-        return subImage;
     }
-};
+}
+/**
+ * Replaces every pixel of an image with a function of itself.
+ * @param img the image to change
+ * @param function called with each pixel, returning the new pixel
+ */
+template <class Function>
+void transformPixels(RGBImage& img, Function function) {
+    transformPixels(img, img, function);
+}
+
 /**
  * Overloading of operator>> reads image pixel data into the RGBImage from
  * a file stream. This assumes that the RGBImage has been properly initialized
@@ -401,17 +358,25 @@ public:
 std::ifstream& operator>>(std::ifstream& ifs, RGBImage& destImg) {
     // note that bmp format has the origin at the bottom left
     // while RGBImage has the origin at the top left
-    int padding = getScanlinePadding(destImg.getWidth());
-    for(int y = destImg.getHeight() - 1; y >= 0; y--)
+    int scanlineSize = destImg.getWidth()*PIXEL_SIZE + getScanlinePadding(destImg.getWidth());
+    // read as many whole scanlines as fit in a batch with a single read
+    int batchRows = std::max(1, DECODE_BATCH_SIZE / std::max(1, scanlineSize));
+    std::vector<byte> batch(std::max<size_t>(1, (size_t)std::min(batchRows, destImg.getHeight()) * scanlineSize));
+    PixelRows<RGBPixel> destRows = destImg.getRows();
+
+    int y = destImg.getHeight() - 1;
+    while(y >= 0)
     {
-        for(int x = 0; x < destImg.getWidth(); x++)
+        int rows = std::min(batchRows, y + 1);
+        if(!ifs.read(reinterpret_cast<char*>(&batch[0]), (std::streamsize)rows * scanlineSize))
+        {
+            break;
+        }
+        // convert each scanline, skipping its padding
+        for(int i = 0; i < rows; i++, y--)
         {
-            RGBPixel pix;
-            ifs >> pix;
-            destImg.setRGB(x, y, pix);
+            decodeScanline(&batch[(size_t)i * scanlineSize], destRows[y].data(), destRows.getWidth());
         }
-        // after every scanline, ignore the padding
-        ifs.ignore(padding);
     }
     return ifs;
 }
@@ -426,18 +391,23 @@ std::ifstream& operator>>(std::ifstream& ifs, RGBImage& destImg) {
 std::ofstream& operator<<(std::ofstream& ofs, const RGBImage& srcImg) {
     // note that bmp format has the origin at the bottom left
     // while RGBImage has the origin at the top left
-    int padding = getScanlinePadding(srcImg.getWidth());
-    for(int y = srcImg.getHeight() - 1; y >= 0; y--)
+    int scanlineSize = srcImg.getWidth()*PIXEL_SIZE + getScanlinePadding(srcImg.getWidth());
+    // convert as many whole scanlines as fit in a batch, then write them all
+    // at once. The buffer is reused for every batch, and its padding bytes
+    // are never written to so they stay zero.
+    int batchRows = std::max(1, ENCODE_BATCH_SIZE / std::max(1, scanlineSize));
+    std::vector<byte> batch(std::max<size_t>(1, (size_t)std::min(batchRows, srcImg.getHeight()) * scanlineSize), 0);
+    PixelRows<const RGBPixel> srcRows = srcImg.getRows();
+
+    int y = srcImg.getHeight() - 1;
+    while(y >= 0 && ofs)
     {
-        for(int x = 0; x < srcImg.getWidth(); x++)
+        int rows = std::min(batchRows, y + 1);
+        for(int i = 0; i < rows; i++, y--)
         {
-            ofs << srcImg.getRGB(x,y);
-        }
-        // After every scanline, write padding if necessary
-        for(int i = 0; i < padding; i++)
-        {
-            ofs.put(0);
+            encodeScanline(srcRows[y].data(), &batch[(size_t)i * scanlineSize], srcRows.getWidth());
         }
+        ofs.write(reinterpret_cast<const char*>(&batch[0]), (std::streamsize)rows * scanlineSize);
     }
 
     return ofs;
@@ -452,54 +422,86 @@ std::ofstream& operator<<(std::ofstream& ofs, const RGBImage& srcImg) {
  * @return a reference to the output stream.
  */
 std::ostream& operator<<(std::ostream& os, const RGBImage& srcImg) {
-    for(int y = 0; y < srcImg.getHeight(); y++)
+    PixelRows<const RGBPixel> rows = srcImg.getRows();
+    for(int y = 0; y < rows.getHeight(); y++)
     {
-        for(int x = 0; x < srcImg.getWidth(); x++)
+        for(int x = 0; x < rows.getWidth(); x++)
         {
-            os << "pix: (" << x << ',' << y << "): " << srcImg.getRGB(x, y) << '\n';
+            os << "pix: (" << x << ',' << y << "): " << rows[y][x] << '\n';
         }
     }
     return os;
 }
 
 /**
- * Writes all of the necessary header information about the given RGBImage to
- * the given file stream.
- * @param ofs the file output stream that the header will be written to.
- * @param srcImg the source image that the header will be determined using.
+ * Fills in all of the necessary header information for a bitmap of the given
+ * dimensions. Any header bytes that aren't used are set to 0.
+ * @param header the buffer the header is built in, DATA_START_INDEX bytes long.
+ * @param width the width of the bitmap in pixels.
+ * @param height the height of the bitmap in pixels.
  */
-void writeHeader(std::ofstream& ofs, const RGBImage& srcImg) {
+void fillHeader(byte* header, int width, int height) {
+    std::fill(header, header + DATA_START_INDEX, 0);
+
     // constant values for bitmap header
-    putShort(ofs, FILE_START_INDEX, BMP_IDENTIFIER); // BMP header identifier, constant 0x4d42
-    putInt(ofs, DATA_START_INDEX_INDEX, DATA_START_INDEX); // position where the read starts, constant 54
-    putInt(ofs, HEADER_SIZE_INDEX, HEADER_SIZE); // size of header, constant 40
-    putShort(ofs, PLANES_INDEX, PLANES); // number of "planes" in image, constant 1
-    putShort(ofs, BIT_DEPTH_INDEX, BIT_DEPTH); // bit-depth of a pixel, constant 24
+    writeShort(header, FILE_START_INDEX, BMP_IDENTIFIER); // BMP header identifier, constant 0x4d42
+    writeInt(header, DATA_START_INDEX_INDEX, DATA_START_INDEX); // position where the read starts, constant 54
+    writeInt(header, HEADER_SIZE_INDEX, HEADER_SIZE); // size of header, constant 40
+    writeShort(header, PLANES_INDEX, PLANES); // number of "planes" in image, constant 1
+    writeShort(header, BIT_DEPTH_INDEX, BIT_DEPTH); // bit-depth of a pixel, constant 24
 
     // values of bitmap header dependent upon the bitmap
-    putInt(ofs, WIDTH_INDEX, srcImg.getWidth()); // width of bitmap in pixels
-    putInt(ofs, HEIGHT_INDEX, srcImg.getHeight()); // height of bitmap in pixels
+    writeInt(header, WIDTH_INDEX, width); // width of bitmap in pixels
+    writeInt(header, HEIGHT_INDEX, height); // height of bitmap in pixels
 
-    int scanline = srcImg.getWidth()*PIXEL_SIZE;
-    int imageDataSize = (scanline + getScanlinePadding(srcImg.getWidth())) * srcImg.getHeight();
-    putInt(ofs, IMAGE_SIZE_INDEX, imageDataSize);
-    putInt(ofs, FILE_SIZE_INDEX, imageDataSize + DATA_START_INDEX);
+    int scanline = width*PIXEL_SIZE;
+    int imageDataSize = (scanline + getScanlinePadding(width)) * height;
+    writeInt(header, IMAGE_SIZE_INDEX, imageDataSize);
+    writeInt(header, FILE_SIZE_INDEX, imageDataSize + DATA_START_INDEX);
+}
+/**
+ * Writes all of the necessary header information about the given RGBImage to
+ * the given file stream. The header is built in memory and written at once.
+ * @param ofs the file output stream that the header will be written to.
+ * @param srcImg the source image that the header will be determined using.
+ */
+void writeHeader(std::ofstream& ofs, const RGBImage& srcImg) {
+    byte header[DATA_START_INDEX];
+    fillHeader(header, srcImg.getWidth(), srcImg.getHeight());
+    ofs.write(reinterpret_cast<const char*>(header), DATA_START_INDEX);
 }
 /**
  * Saves the given image to a file at the given filename.
  * @param filename the name of the file that the image will be saved to.
  * @param srcImg the image to be saved.
+ * @throws FileException if the file cannot be written
  */
 void saveImage(std::string filename, const RGBImage& srcImg) {
         std::ofstream ofs;
         ofs.open(filename.c_str(), std::ios::out | std::ios::binary);
 
         writeHeader(ofs, srcImg);
-        ofs.seekp(DATA_START_INDEX);
         ofs << srcImg;
 
         ofs.close();
+        if(!ofs)
+        {
+            throw FileException(filename, "File cannot be written");
+        }
     }
+/**
+ * Gets the filename that one of several images is saved to, by putting its
+ * number before the extension.
+ * @param filename the base filename, ending in a 4 character extension
+ * @param number the number of the image
+ * @return the numbered filename
+ */
+std::string getNumberedFilename(const std::string& filename, int number) {
+    std::stringstream stream;
+    stream << filename.substr(0, filename.size() - 4) << number
+           << filename.substr(filename.size() - 4);
+    return stream.str();
+}
 /**
  * Saves the given images to files of the given filename plus a number.
  * @param filename the base filename that the image will be saved to.
@@ -508,10 +510,7 @@ void saveImage(std::string filename, const RGBImage& srcImg) {
 void saveImages(std::string filename, const std::vector<RGBImage>& srcImgs) {
     for(int i = 0; i < srcImgs.size(); i++)
     {
-        std::stringstream stream;
-        stream << filename.substr(0, filename.size() - 4) << i 
-               << filename.substr(filename.size() - 4);
-        saveImage(stream.str(), srcImgs[i]);
+        saveImage(getNumberedFilename(filename, i), srcImgs[i]);
     }
 }
 }
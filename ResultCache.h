@@ -0,0 +1,441 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Exceptions.h"
+#include "MappedBitmap.h"
+#include "RGBImage.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#define IMANIP_HAS_RESULT_CACHE 1
+#endif
+
+namespace IManip {
+
+/** the most bytes of entries a cache keeps by default, 1GB */
+const size_t CACHE_DEFAULT_LIMIT = (size_t)1 << 30;
+/** the first bytes of every cache entry, changed whenever the layout changes */
+const char CACHE_MAGIC[8] = { 'I', 'M', 'C', 'A', 'C', 'H', 'E', '2' };
+/**
+ * the version of the code that works out cached results, mixed into every
+ * key. Bump it whenever any command's output changes, so that results kept
+ * by older builds are no longer found.
+ */
+const uint32_t CACHE_VERSION = 1;
+/** the extension of complete cache entries */
+const std::string CACHE_EXTENSION = ".imc";
+/** how old a partly written entry must be before it is assumed abandoned, in seconds */
+const int CACHE_STALE_SECONDS = 3600;
+/** how long commands must take before the images after them are worth keeping, in seconds */
+const double CACHE_PREFIX_SECONDS = 0.1;
+
+/**
+ * Hashes a run of bytes, 8 at a time, into a running 64-bit hash. This is a
+ * fast multiply and rotate mix for telling inputs apart, not a secure hash.
+ * @param data the bytes to hash
+ * @param size the number of bytes
+ * @param hash the hash of everything before these bytes, or any seed
+ * @return the hash of everything up to and including these bytes
+ */
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+    const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    const byte* bytes = static_cast<const byte*>(data);
+    hash ^= size * PRIME1;
+    size_t i = 0;
+    for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        word *= PRIME2;
+        word = (word << 31) | (word >> 33);
+        hash ^= word * PRIME1;
+        hash = ((hash << 27) | (hash >> 37)) * PRIME1 + PRIME2;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes + i, size - i);
+    hash ^= tail * PRIME2;
+    // spread every input bit over the whole hash
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    return hash;
+}
+/**
+ * Hashes the size and pixels of an image. Row padding isn't hashed, so equal
+ * images hash the same however they are laid out.
+ * @param img the image to hash
+ * @return the hash of the image
+ */
+uint64_t hashImage(const RGBImage& img) {
+    int size[2] = { img.getWidth(), img.getHeight() };
+    uint64_t hash = hashBytes(size, sizeof(size), 0);
+    PixelRows<const RGBPixel> rows = img.getRows();
+    for(int y = 0; y < rows.getHeight(); y++)
+    {
+        hash = hashBytes(rows[y].data(), (size_t)rows.getWidth() * sizeof(RGBPixel), hash);
+    }
+    return hash;
+}
+/**
+ * Hashes the size and pixels of a mapped bitmap without decoding it, one
+ * row at a time. The hash is the same as that of the decoded image.
+ * @param srcImg the mapped bitmap to hash
+ * @return the hash of the image
+ */
+uint64_t hashImage(const MappedBitmap& srcImg) {
+    int size[2] = { srcImg.getWidth(), srcImg.getHeight() };
+    uint64_t hash = hashBytes(size, sizeof(size), 0);
+    std::vector<RGBPixel> row(srcImg.getWidth());
+    for(int y = 0; y < srcImg.getHeight(); y++)
+    {
+        decodeScanline(srcImg.getScanline(y), row.data(), srcImg.getWidth());
+        hash = hashBytes(row.data(), row.size() * sizeof(RGBPixel), hash);
+    }
+    return hash;
+}
+
+/**
+ * Identifies a cache entry by the input and the commands run on it so far.
+ * Entries are filed under the hash of both, and hold both as well, so that
+ * two keys with the same hash are told apart.
+ */
+struct CacheKey {
+    /** the hash of the input's pixels, with CACHE_VERSION mixed in */
+    uint64_t inputHash;
+    /** the canonical text of the commands */
+    std::string commands;
+
+    /**
+     * Creates a key.
+     * @param inputHash the hash of the input's pixels, with CACHE_VERSION mixed in
+     * @param commands the canonical text of the commands
+     */
+    CacheKey(uint64_t inputHash, const std::string& commands) : inputHash(inputHash), commands(commands) { }
+
+    /**
+     * Gets the hash the entry is filed under.
+     * @return the hash of the input and the commands
+     */
+    uint64_t getHash() const {
+        return hashBytes(commands.data(), commands.size(), inputHash);
+    }
+};
+
+/**
+ * ResultCache keeps the results of running commands in a directory, so that
+ * running the same commands on the same input again loads the result instead.
+ * Each entry holds the images left after some commands, under a key that the
+ * caller works out from the input and the commands.
+ *
+ * Several processes may share a directory. Entries are written under a
+ * temporary name and renamed into place, so a reader only ever sees complete
+ * entries. Each hit marks its entry as used, and once the entries add up to
+ * more than the limit, the least recently used are removed. The cache never
+ * fails a run after it is opened: an entry that can't be read is a miss, and
+ * one that can't be written is skipped.
+ */
+class ResultCache {
+private:
+    /** the directory the entries are kept in */
+    std::string directory;
+    /** the most bytes of entries to keep */
+    size_t limit;
+    /** numbers this process's temporary files, so its threads never share one */
+    std::atomic<unsigned> nextTemporary;
+
+    /**
+     * A complete entry found in the directory while evicting.
+     */
+    struct EntryFile {
+        /** when the entry was last used, in seconds */
+        time_t usedSeconds;
+        /** the nanoseconds past usedSeconds */
+        long usedNanoseconds;
+        /** the size of the file in bytes */
+        size_t size;
+        /** the name of the file */
+        std::string path;
+
+        /**
+         * Orders entries from the least recently used.
+         * @param other the entry to compare to
+         * @return true if this entry was used before the other
+         */
+        bool operator<(const EntryFile& other) const {
+            if(usedSeconds != other.usedSeconds)
+            {
+                return usedSeconds < other.usedSeconds;
+            }
+            if(usedNanoseconds != other.usedNanoseconds)
+            {
+                return usedNanoseconds < other.usedNanoseconds;
+            }
+            return path < other.path;
+        }
+    };
+
+    ResultCache(const ResultCache&);
+    ResultCache& operator=(const ResultCache&);
+
+    /**
+     * Works out the size of the file an entry is written to.
+     * @param key the key of the entry
+     * @param images the images of the entry
+     * @return the size of the entry in bytes
+     */
+    static size_t getEntrySize(const CacheKey& key, const std::vector<RGBImage>& images) {
+        size_t size = sizeof(CACHE_MAGIC) + sizeof(uint64_t) + sizeof(uint32_t) + key.commands.size() + sizeof(uint32_t);
+        for(size_t i = 0; i < images.size(); i++)
+        {
+            size += 2 * sizeof(int32_t) + (size_t)images[i].getWidth() * images[i].getHeight() * sizeof(RGBPixel);
+        }
+        return size;
+    }
+
+    /**
+     * Writes an entry.
+     * @param ofs the stream to write to
+     * @param key the key of the entry
+     * @param images the images to write
+     */
+    static void writeEntry(std::ofstream& ofs, const CacheKey& key, const std::vector<RGBImage>& images) {
+        ofs.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        ofs.write(reinterpret_cast<const char*>(&key.inputHash), sizeof(key.inputHash));
+        uint32_t length = key.commands.size();
+        ofs.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        ofs.write(key.commands.data(), length);
+        uint32_t count = images.size();
+        ofs.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        for(size_t i = 0; i < images.size(); i++)
+        {
+            int32_t size[2] = { images[i].getWidth(), images[i].getHeight() };
+            ofs.write(reinterpret_cast<const char*>(size), sizeof(size));
+            PixelRows<const RGBPixel> rows = images[i].getRows();
+            for(int y = 0; y < rows.getHeight(); y++)
+            {
+                ofs.write(reinterpret_cast<const char*>(rows[y].data()), (size_t)rows.getWidth() * sizeof(RGBPixel));
+            }
+        }
+    }
+    /**
+     * Reads the images of an entry, if it is the entry of the given key.
+     * @param ifs the stream to read from
+     * @param remaining the number of bytes in the stream
+     * @param key the key the entry should have
+     * @param images set to the images read
+     * @return true if a whole, valid entry of the key was read
+     */
+    static bool readEntry(std::ifstream& ifs, size_t remaining, const CacheKey& key, std::vector<RGBImage>& images) {
+        char magic[sizeof(CACHE_MAGIC)];
+        uint64_t inputHash;
+        uint32_t length;
+        ifs.read(magic, sizeof(magic));
+        ifs.read(reinterpret_cast<char*>(&inputHash), sizeof(inputHash));
+        ifs.read(reinterpret_cast<char*>(&length), sizeof(length));
+        // an entry whose hash matches but whose key doesn't is a collision
+        if(!ifs || std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0
+        || inputHash != key.inputHash || length != key.commands.size())
+        {
+            return false;
+        }
+        std::string commands(length, 0);
+        uint32_t count;
+        ifs.read(&commands[0], length);
+        ifs.read(reinterpret_cast<char*>(&count), sizeof(count));
+        if(!ifs || commands != key.commands)
+        {
+            return false;
+        }
+        remaining -= std::min(remaining, sizeof(magic) + sizeof(inputHash) + sizeof(length) + length + sizeof(count));
+        images.clear();
+        for(uint32_t i = 0; i < count; i++)
+        {
+            int32_t size[2];
+            ifs.read(reinterpret_cast<char*>(size), sizeof(size));
+            remaining -= std::min(remaining, sizeof(size));
+            // don't trust a size that the rest of the entry can't hold
+            if(!ifs || size[0] < 0 || size[1] < 0 || (double)size[0] * size[1] * sizeof(RGBPixel) > remaining)
+            {
+                return false;
+            }
+            remaining -= (size_t)size[0] * size[1] * sizeof(RGBPixel);
+            RGBImage img(size[0], size[1], false);
+            PixelRows<RGBPixel> rows = img.getRows();
+            for(int y = 0; y < rows.getHeight(); y++)
+            {
+                ifs.read(reinterpret_cast<char*>(rows[y].data()), (size_t)rows.getWidth() * sizeof(RGBPixel));
+            }
+            if(!ifs)
+            {
+                return false;
+            }
+            images.push_back(img);
+        }
+        return true;
+    }
+public:
+    /**
+     * Opens a cache directory, creating it if it doesn't exist.
+     * @param directory the directory the entries are kept in
+     * @param limit the most bytes of entries to keep
+     * @throws FileException if the directory can't be created
+     * @throws IllegalArgumentException if the cache isn't supported on this platform
+     */
+    ResultCache(const std::string& directory, size_t limit = CACHE_DEFAULT_LIMIT)
+        : directory(directory), limit(limit), nextTemporary(0) {
+#ifdef IMANIP_HAS_RESULT_CACHE
+        mkdir(directory.c_str(), 0777);
+        struct stat info;
+        if(stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+        {
+            throw FileException(directory, "Cache directory cannot be created");
+        }
+#else
+        throw IllegalArgumentException("The result cache is not supported on this platform");
+#endif
+    }
+
+    /**
+     * Gets the file an entry is kept in.
+     * @param key the key of the entry
+     * @return the name of the entry's file
+     */
+    std::string getEntryFilename(const CacheKey& key) const {
+        std::stringstream stream;
+        stream << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key.getHash() << CACHE_EXTENSION;
+        return stream.str();
+    }
+
+    /**
+     * Loads an entry and marks it as just used.
+     * @param key the key of the entry
+     * @param images set to the images of the entry if it is found
+     * @return true if the entry was found and read
+     */
+    bool load(const CacheKey& key, std::vector<RGBImage>& images) {
+        std::string filename = getEntryFilename(key);
+        std::ifstream ifs(filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+        std::vector<RGBImage> entry;
+        if(!ifs.good())
+        {
+            return false;
+        }
+        size_t fileSize = ifs.tellg();
+        ifs.seekg(0);
+        if(!readEntry(ifs, fileSize, key, entry))
+        {
+            return false;
+        }
+#ifdef IMANIP_HAS_RESULT_CACHE
+        utime(filename.c_str(), 0);
+#endif
+        images.swap(entry);
+        return true;
+    }
+    /**
+     * Stores an entry, replacing any with the same key, then removes the
+     * least recently used entries other than it if the cache is over its
+     * limit. An entry larger than the whole limit isn't stored.
+     * @param key the key of the entry
+     * @param images the images to store
+     */
+    void store(const CacheKey& key, const std::vector<RGBImage>& images) {
+#ifdef IMANIP_HAS_RESULT_CACHE
+        if(getEntrySize(key, images) > limit)
+        {
+            return;
+        }
+        std::string filename = getEntryFilename(key);
+        std::stringstream temporary;
+        temporary << filename << "." << getpid() << "." << nextTemporary++ << ".tmp";
+        std::ofstream ofs(temporary.str().c_str(), std::ios::out | std::ios::binary);
+        writeEntry(ofs, key, images);
+        ofs.close();
+        if(!ofs || std::rename(temporary.str().c_str(), filename.c_str()) != 0)
+        {
+            std::remove(temporary.str().c_str());
+            return;
+        }
+        evict(filename);
+#endif
+    }
+    /**
+     * Removes the least recently used entries until the rest fit in the
+     * limit, along with any partly written entries that were abandoned.
+     * Entries another process removes first are skipped.
+     * @param keep the file of an entry that is never removed, such as one
+     *        just stored, or empty to consider every entry
+     */
+    void evict(const std::string& keep = "") {
+#ifdef IMANIP_HAS_RESULT_CACHE
+        DIR* dir = opendir(directory.c_str());
+        if(!dir)
+        {
+            return;
+        }
+        std::vector<EntryFile> entries;
+        size_t total = 0;
+        time_t now = std::time(0);
+        while(dirent* item = readdir(dir))
+        {
+            std::string name = item->d_name;
+            std::string path = directory + "/" + name;
+            struct stat info;
+            if(stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+            {
+                continue;
+            }
+            if(name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0)
+            {
+                if(now - info.st_mtime > CACHE_STALE_SECONDS)
+                {
+                    std::remove(path.c_str());
+                }
+            }
+            else if(name.size() > CACHE_EXTENSION.size()
+                    && name.compare(name.size() - CACHE_EXTENSION.size(), CACHE_EXTENSION.size(), CACHE_EXTENSION) == 0)
+            {
+                EntryFile entry;
+                // the mtime is marked on every hit, to the nanosecond where it is recorded
+#ifdef __APPLE__
+                entry.usedSeconds = info.st_mtimespec.tv_sec;
+                entry.usedNanoseconds = info.st_mtimespec.tv_nsec;
+#else
+                entry.usedSeconds = info.st_mtim.tv_sec;
+                entry.usedNanoseconds = info.st_mtim.tv_nsec;
+#endif
+                entry.size = info.st_size;
+                entry.path = path;
+                entries.push_back(entry);
+                total += entry.size;
+            }
+        }
+        closedir(dir);
+
+        std::sort(entries.begin(), entries.end());
+        for(size_t i = 0; i < entries.size() && total > limit; i++)
+        {
+            if(entries[i].path != keep)
+            {
+                std::remove(entries[i].path.c_str());
+                total -= entries[i].size;
+            }
+        }
+#endif
+    }
+};
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <vector>
+#include "RGBPixel.h"
+
+namespace IManip {
+
+/**
+ * ScanlineSink is the base abstract class for anything that rows of an image
+ * can be handed to one at a time, such as the next filter in a stream or the
+ * file that the stream is being written to.
+ */
+class ScanlineSink {
+public:
+    virtual ~ScanlineSink() {}
+
+    /**
+     * Takes one row of an image. The row only needs to stay valid for the
+     * duration of the call, so the sink must copy anything it wants to keep.
+     * @param y the y coordinate of the row
+     * @param row the first of the row's pixels
+     */
+    virtual void putScanline(int y, const RGBPixel* row) = 0;
+};
+
+/**
+ * ScanlineFilter is the base class for filters that are row-local: every row
+ * of their output depends only on a single row of their input. Those filters
+ * can be streamed, filtering an image a row at a time without ever holding the
+ * whole image in memory. A filter that is row-local should inherit from
+ * ScanlineFilter as well as ImageFilter and override filterScanline.
+ *
+ * Rows are streamed in the order that they are stored in a bitmap file, from
+ * the bottom of the image to the top, and a ScanlineFilter must hand its
+ * output rows on in that same order.
+ */
+class ScanlineFilter {
+private:
+    /** a row for the filter to build its output in, reused for every row */
+    std::vector<RGBPixel> scanline;
+protected:
+    /**
+     * Gets a row buffer that the filter can build an output row in. The same
+     * buffer is handed back every time, so an output row must be passed on
+     * before the next one is built.
+     * @param width the number of pixels needed in the row
+     * @return a pointer to the first pixel of the buffer
+     */
+    RGBPixel* getScanlineBuffer(int width) {
+        if(scanline.size() < (size_t)width + 1)
+        {
+            scanline.resize(width + 1);
+        }
+        return &scanline[0];
+    }
+public:
+    virtual ~ScanlineFilter() {}
+
+    /**
+     * Gets the width of the images that this filter produces.
+     * @param width the width of the source image
+     * @param height the height of the source image
+     * @return the width of the filtered image
+     */
+    virtual int getFilteredWidth(int width, int) {
+        return width;
+    }
+    /**
+     * Gets the height of the images that this filter produces.
+     * @param width the width of the source image
+     * @param height the height of the source image
+     * @return the height of the filtered image
+     */
+    virtual int getFilteredHeight(int, int height) {
+        return height;
+    }
+    /**
+     * Filters one row of the source image and hands the resulting rows, if
+     * any, on to the sink.
+     * @param y the y coordinate of the source row
+     * @param row the first of the source row's pixels
+     * @param width the width of the source image
+     * @param height the height of the source image
+     * @param sink where the filtered rows are handed on to
+     */
+    virtual void filterScanline(int y, const RGBPixel* row, int width, int height,
+                                ScanlineSink& sink) = 0;
+};
+
+}
@@ -0,0 +1,273 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include "Exceptions.h"
+#include "RGBImage.h"
+#include "ScanlineFilter.h"
+
+namespace IManip {
+
+/**
+ * BitmapScanlineReader reads a bitmap file one scanline at a time, so that
+ * only a single row of the image is ever held in memory. Rows come out in the
+ * order they are stored in the file, from the bottom of the image to the top.
+ */
+class BitmapScanlineReader {
+private:
+    /** the file being read */
+    std::ifstream ifs;
+    /** the name of the file being read */
+    std::string filename;
+    /** the image width in pixels */
+    int width;
+    /** the image height in pixels */
+    int height;
+    /** the y coordinate of the next row to be read */
+    int nextY;
+    /** the raw b,g,r bytes of the last scanline read, padding included */
+    std::vector<byte> scanline;
+    /** the last scanline read, converted to pixels */
+    std::vector<RGBPixel> row;
+public:
+    /**
+     * Opens a bitmap file and reads its header.
+     * @param filename the name of the bitmap file to read.
+     * @throws FileException if the file does not exist, is not a bitmap, or is corrupt.
+     */
+    BitmapScanlineReader(std::string filename) : filename(filename) {
+        ifs.open(filename.c_str(), std::ios::in | std::ios::binary);
+        if(!ifs.good())
+        {
+            throw FileException(filename, "File cannot be read or does not exist");
+        }
+        byte header[DATA_START_INDEX];
+        ifs.read(reinterpret_cast<char*>(header), DATA_START_INDEX);
+        int dataStart;
+        parseHeader(header, ifs.gcount(), filename, width, height, dataStart);
+        if(width < 0 || height < 0)
+        {
+            throw FileException(filename, "File is not a valid bitmap.");
+        }
+        ifs.seekg(dataStart);
+
+        nextY = height - 1;
+        scanline.resize(width * PIXEL_SIZE + getScanlinePadding(width) + 1);
+        row.resize(width + 1);
+    }
+    /**
+     * Gets the width of the image in pixels.
+     * @return the width of the image in pixels.
+     */
+    int getWidth() const {
+        return width;
+    }
+    /**
+     * Gets the height of the image in pixels.
+     * @return the height of the image in pixels.
+     */
+    int getHeight() const {
+        return height;
+    }
+    /**
+     * Reads the next scanline of the file.
+     * @param y set to the y coordinate of the row that was read.
+     * @return the row that was read, valid until the next call, or null once
+     *         every row has been read.
+     * @throws FileException if the file ends early
+     */
+    const RGBPixel* readScanline(int& y) {
+        if(nextY < 0)
+        {
+            return 0;
+        }
+        if(!ifs.read(reinterpret_cast<char*>(&scanline[0]), scanline.size() - 1))
+        {
+            throw FileException(filename, "File is not a valid bitmap.");
+        }
+        decodeScanline(&scanline[0], &row[0], width);
+        y = nextY--;
+        return &row[0];
+    }
+};
+
+/**
+ * BitmapScanlineWriter writes a bitmap file one scanline at a time. It is
+ * the last sink in a stream of filters. The rows must be handed to it in the
+ * order they are stored in the file, from the bottom of the image to the top.
+ */
+class BitmapScanlineWriter : public ScanlineSink {
+private:
+    /** the file being written */
+    std::ofstream ofs;
+    /** the name of the file being written */
+    std::string filename;
+    /** the image width in pixels */
+    int width;
+    /** the y coordinate of the next row that can be written */
+    int nextY;
+    /** the b,g,r bytes of a scanline, its padding always zero */
+    std::vector<byte> scanline;
+public:
+    /**
+     * Creates a bitmap file for an image of the given dimensions and writes
+     * its header.
+     * @param filename the name of the file to write.
+     * @param width the width of the image in pixels.
+     * @param height the height of the image in pixels.
+     * @throws IllegalArgumentException if either dimension is negative
+     * @throws FileException if the file cannot be written
+     */
+    BitmapScanlineWriter(std::string filename, int width, int height)
+            : filename(filename), width(width), nextY(height - 1) {
+        if(width < 0 || height < 0)
+        {
+            std::stringstream stream;
+            stream << "Dimensions must be greater than zero. Width: "
+                   << width << " Height: " << height << "\n";
+            throw IllegalArgumentException(stream.str());
+        }
+        ofs.open(filename.c_str(), std::ios::out | std::ios::binary);
+
+        byte header[DATA_START_INDEX];
+        fillHeader(header, width, height);
+        ofs.write(reinterpret_cast<const char*>(header), DATA_START_INDEX);
+        if(!ofs)
+        {
+            throw FileException(filename, "File cannot be written");
+        }
+
+        scanline.resize(width * PIXEL_SIZE + getScanlinePadding(width) + 1, 0);
+    }
+    /**
+     * Encodes and writes one row of the image.
+     * @param y the y coordinate of the row, which must be the next one down.
+     * @param row the first of the row's pixels.
+     * @throws IllegalArgumentException if the rows arrive out of order
+     * @throws FileException if the file cannot be written
+     */
+    virtual void putScanline(int y, const RGBPixel* row) {
+        if(y != nextY)
+        {
+            std::stringstream stream;
+            stream << "Scanline " << y << " streamed out of order, expected " << nextY;
+            throw IllegalArgumentException(stream.str());
+        }
+        encodeScanline(row, &scanline[0], width);
+        if(!ofs.write(reinterpret_cast<const char*>(&scanline[0]), scanline.size() - 1))
+        {
+            throw FileException(filename, "File cannot be written");
+        }
+        nextY--;
+    }
+    /**
+     * Closes the file once every row has been written.
+     * @throws IllegalArgumentException if some rows were never written
+     * @throws FileException if the file cannot be written
+     */
+    void finish() {
+        if(nextY != -1)
+        {
+            std::stringstream stream;
+            stream << "Stream ended with " << nextY + 1 << " scanlines unwritten";
+            throw IllegalArgumentException(stream.str());
+        }
+        ofs.close();
+        if(!ofs)
+        {
+            throw FileException(filename, "File cannot be written");
+        }
+    }
+};
+
+/**
+ * ScanlineStage feeds the rows handed to it through one ScanlineFilter, and
+ * the filtered rows on to the next sink in the stream.
+ */
+class ScanlineStage : public ScanlineSink {
+private:
+    /** the filter this stage applies */
+    ScanlineFilter& filter;
+    /** the width of the images coming into this stage */
+    int width;
+    /** the height of the images coming into this stage */
+    int height;
+    /** the sink that filtered rows are handed on to */
+    ScanlineSink& next;
+public:
+    /**
+     * Creates a stage of a stream.
+     * @param filter the filter this stage applies
+     * @param width the width of the images coming into this stage
+     * @param height the height of the images coming into this stage
+     * @param next the sink that filtered rows are handed on to
+     */
+    ScanlineStage(ScanlineFilter& filter, int width, int height, ScanlineSink& next)
+            : filter(filter), width(width), height(height), next(next) { }
+
+    /**
+     * Filters a row and hands the result on to the next sink.
+     * @param y the y coordinate of the row
+     * @param row the first of the row's pixels
+     */
+    virtual void putScanline(int y, const RGBPixel* row) {
+        filter.filterScanline(y, row, width, height, next);
+    }
+};
+
+/**
+ * Streams a bitmap file through a chain of row-local filters into another
+ * bitmap file. Only a few rows per filter are held in memory at once, so this
+ * works on images that are much larger than the memory available.
+ * @param inputFilename the name of the bitmap file to read.
+ * @param outputFilename the name of the bitmap file to write.
+ * @param filters the filters to apply, in order.
+ * @throws FileException if either file cannot be used.
+ * @throws IllegalArgumentException if any filter produces negative dimensions.
+ */
+void streamFilters(std::string inputFilename, std::string outputFilename,
+                   const std::vector<ScanlineFilter*>& filters) {
+    BitmapScanlineReader reader(inputFilename);
+
+    // work out the size of the image coming into each of the filters
+    std::vector<int> widths(1, reader.getWidth());
+    std::vector<int> heights(1, reader.getHeight());
+    for(int i = 0; i < filters.size(); i++)
+    {
+        int width = filters[i]->getFilteredWidth(widths.back(), heights.back());
+        int height = filters[i]->getFilteredHeight(widths.back(), heights.back());
+        if(width < 0 || height < 0)
+        {
+            std::stringstream stream;
+            stream << "Dimensions must be greater than zero. Width: "
+                   << width << " Height: " << height << "\n";
+            throw IllegalArgumentException(stream.str());
+        }
+        widths.push_back(width);
+        heights.push_back(height);
+    }
+
+    // link the stages together from the file being written back to the start
+    BitmapScanlineWriter writer(outputFilename, widths.back(), heights.back());
+    std::vector<std::unique_ptr<ScanlineStage> > stages;
+    ScanlineSink* sink = &writer;
+    for(int i = filters.size() - 1; i >= 0; i--)
+    {
+        stages.push_back(std::unique_ptr<ScanlineStage>(
+                new ScanlineStage(*filters[i], widths[i], heights[i], *sink)));
+        sink = stages.back().get();
+    }
+
+    // then push every row of the source through
+    int y;
+    const RGBPixel* row;
+    while((row = reader.readScanline(y)) != 0)
+    {
+        sink->putScanline(y, row);
+    }
+    writer.finish();
+}
+
+}
@@ -0,0 +1,233 @@
+#pragma once
+#include <cstddef>
+#include "RGBImage.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define IMANIP_X86_SIMD 1
+#define IMANIP_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace IManip {
+
+// the kernels treat a run of pixels as a run of bytes, so pixels must be packed
+static_assert(sizeof(RGBPixel) == PIXEL_SIZE, "RGBPixel must be exactly PIXEL_SIZE bytes");
+
+/*
+ * These kernels do the per-byte work of pointwise filters over packed 24-bit
+ * pixel data, treating a run of pixels as a plain run of r,g,b bytes. Each one
+ * has a scalar version and, on x86, SSE2, AVX2 and AVX-512 versions. The
+ * fastest version the CPU supports is picked at runtime, and every version
+ * gives exactly the same bytes as the scalar one.
+ */
+
+/**
+ * The instruction sets that the kernels can be run with, slowest first.
+ */
+enum SimdLevel {
+    SIMD_SCALAR, /// plain C++, works everywhere
+    SIMD_SSE2,   /// 16 byte vectors
+    SIMD_AVX2,   /// 32 byte vectors
+    SIMD_AVX512  /// 64 byte vectors, needs AVX-512F and AVX-512BW
+};
+
+/**
+ * Asks the CPU which of the instruction sets it supports.
+ * @return the fastest instruction set the CPU supports
+ */
+SimdLevel detectSimdLevel() {
+#ifdef IMANIP_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    {
+        return SIMD_AVX512;
+    }
+    if(__builtin_cpu_supports("avx2"))
+    {
+        return SIMD_AVX2;
+    }
+    if(__builtin_cpu_supports("sse2"))
+    {
+        return SIMD_SSE2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+/**
+ * Gets the instruction set that the kernels are currently run with. This is
+ * detected the first time it is needed.
+ * @return a reference to the current instruction set
+ */
+SimdLevel& currentSimdLevel() {
+    static SimdLevel level = detectSimdLevel();
+    return level;
+}
+/**
+ * Gets the instruction set that the kernels are currently run with.
+ * @return the current instruction set
+ */
+SimdLevel getSimdLevel() {
+    return currentSimdLevel();
+}
+/**
+ * Changes the instruction set that the kernels are run with, for instance to
+ * compare the vector kernels with the scalar ones. The level can be lowered
+ * but never raised past what the CPU supports.
+ * @param level the instruction set to run the kernels with
+ */
+void setSimdLevel(SimdLevel level) {
+    SimdLevel supported = detectSimdLevel();
+    currentSimdLevel() = level < supported ? level : supported;
+}
+
+/**
+ * Inverts a run of bytes with plain C++.
+ * @param src the first of the source bytes
+ * @param dest the first of the bytes to write, may be the same as src
+ * @param count the number of bytes to invert
+ */
+void invertBytesScalar(const byte* src, byte* dest, size_t count) {
+    for(size_t i = 0; i < count; i++)
+    {
+        dest[i] = BYTE_MAX - src[i];
+    }
+}
+
+#ifdef IMANIP_X86_SIMD
+/** Inverts a run of bytes 16 at a time. */
+IMANIP_TARGET("sse2")
+void invertBytesSSE2(const byte* src, byte* dest, size_t count) {
+    const __m128i ones = _mm_set1_epi8((char)BYTE_MAX);
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_xor_si128(v, ones));
+    }
+    invertBytesScalar(src + i, dest + i, count - i);
+}
+/** Inverts a run of bytes 32 at a time. */
+IMANIP_TARGET("avx2")
+void invertBytesAVX2(const byte* src, byte* dest, size_t count) {
+    const __m256i ones = _mm256_set1_epi8((char)BYTE_MAX);
+    size_t i = 0;
+    for(; i + 32 <= count; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_xor_si256(v, ones));
+    }
+    invertBytesSSE2(src + i, dest + i, count - i);
+}
+/** Inverts a run of bytes 64 at a time. */
+IMANIP_TARGET("avx512f,avx512bw")
+void invertBytesAVX512(const byte* src, byte* dest, size_t count) {
+    const __m512i ones = _mm512_set1_epi8((char)BYTE_MAX);
+    size_t i = 0;
+    for(; i + 64 <= count; i += 64)
+    {
+        __m512i v = _mm512_loadu_si512(reinterpret_cast<const void*>(src + i));
+        _mm512_storeu_si512(reinterpret_cast<void*>(dest + i), _mm512_xor_si512(v, ones));
+    }
+    // mask off the tail rather than falling back to narrower vectors
+    if(i < count)
+    {
+        __mmask64 tail = _cvtu64_mask64(~0ULL >> (64 - (count - i)));
+        __m512i v = _mm512_maskz_loadu_epi8(tail, src + i);
+        _mm512_mask_storeu_epi8(dest + i, tail, _mm512_xor_si512(v, ones));
+    }
+}
+#endif
+
+/**
+ * Inverts a run of bytes with the current instruction set.
+ * @param src the first of the source bytes
+ * @param dest the first of the bytes to write, may be the same as src
+ * @param count the number of bytes to invert
+ */
+void invertBytes(const byte* src, byte* dest, size_t count) {
+    switch(getSimdLevel())
+    {
+#ifdef IMANIP_X86_SIMD
+        case SIMD_AVX512: invertBytesAVX512(src, dest, count); return;
+        case SIMD_AVX2: invertBytesAVX2(src, dest, count); return;
+        case SIMD_SSE2: invertBytesSSE2(src, dest, count); return;
+#endif
+        default: invertBytesScalar(src, dest, count); return;
+    }
+}
+
+/**
+ * Splits a run of packed pixels into one plane per channel with plain C++.
+ * @param src the first of the source pixels
+ * @param r the first of the bytes to write the first channel of each pixel to
+ * @param g the first of the bytes to write the second channel of each pixel to
+ * @param b the first of the bytes to write the third channel of each pixel to
+ * @param count the number of pixels to split
+ */
+void splitChannelsScalar(const byte* src, byte* r, byte* g, byte* b, size_t count) {
+    for(size_t i = 0; i < count; i++)
+    {
+        r[i] = src[i*PIXEL_SIZE];
+        g[i] = src[i*PIXEL_SIZE + 1];
+        b[i] = src[i*PIXEL_SIZE + 2];
+    }
+}
+
+#ifdef IMANIP_X86_SIMD
+/**
+ * Splits a run of packed pixels into planes 16 pixels at a time. The 48
+ * bytes of 16 pixels are loaded as three vectors, and each plane is gathered
+ * from the three by byte shuffles. The shuffle needs SSSE3, which every CPU
+ * with AVX2 has, so it is used from SIMD_AVX2 up.
+ */
+IMANIP_TARGET("ssse3")
+void splitChannelsSSSE3(const byte* src, byte* r, byte* g, byte* b, size_t count) {
+    // for each plane, which bytes of each of the three vectors it takes, -1 for none
+    const __m128i rA = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i rB = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i rC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i gA = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i gB = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i gC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i bA = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i bB = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i bC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16)
+    {
+        const byte* pixels = src + i*PIXEL_SIZE;
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+        __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + 32));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(r + i), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a, rA), _mm_shuffle_epi8(m, rB)), _mm_shuffle_epi8(c, rC)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(g + i), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a, gA), _mm_shuffle_epi8(m, gB)), _mm_shuffle_epi8(c, gC)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a, bA), _mm_shuffle_epi8(m, bB)), _mm_shuffle_epi8(c, bC)));
+    }
+    splitChannelsScalar(src + i*PIXEL_SIZE, r + i, g + i, b + i, count - i);
+}
+#endif
+
+/**
+ * Splits a run of packed pixels into one plane per channel with the current
+ * instruction set.
+ * @param src the first of the source pixels
+ * @param r the first of the bytes to write the first channel of each pixel to
+ * @param g the first of the bytes to write the second channel of each pixel to
+ * @param b the first of the bytes to write the third channel of each pixel to
+ * @param count the number of pixels to split
+ */
+void splitChannels(const byte* src, byte* r, byte* g, byte* b, size_t count) {
+#ifdef IMANIP_X86_SIMD
+    if(getSimdLevel() >= SIMD_AVX2)
+    {
+        splitChannelsSSSE3(src, r, g, b, count);
+        return;
+    }
+#endif
+    splitChannelsScalar(src, r, g, b, count);
+}
+
+}
@@ -0,0 +1,279 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "BufferPool.h"
+#include "Trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define IMANIP_HAS_RUSAGE 1
+#endif
+
+// define IMANIP_NO_STATS to compile the stage timers out entirely
+#ifndef IMANIP_NO_STATS
+#define IMANIP_STATS 1
+#endif
+
+namespace IManip {
+
+/**
+ * Gets the processor time used so far by every thread of the process.
+ * @return the user and system time in seconds
+ */
+double getCPUSeconds() {
+#ifdef IMANIP_HAS_RUSAGE
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+           + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#else
+    return (double)std::clock() / CLOCKS_PER_SEC;
+#endif
+}
+/**
+ * Gets the most memory the process has had resident at once.
+ * @return the peak resident set size in bytes, or 0 if it can't be found
+ */
+size_t getPeakRSS() {
+#ifdef IMANIP_HAS_RUSAGE
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss; // already in bytes
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+/**
+ * What one stage of a run cost: decoding the input, running one command, or
+ * encoding one output. Stages run more than once, such as the same command
+ * over every input of a batch, are added together.
+ */
+struct StageStats {
+    /** what the stage did, such as a command or "encode" and a filename */
+    std::string name;
+    /** the number of times the stage was run */
+    int count;
+    /** the time from the start of the stage to its end, in seconds */
+    double wallSeconds;
+    /** the processor time used by the whole process during the stage, in seconds */
+    double cpuSeconds;
+    /** the number of pixels the stage was given, or decoded */
+    long long pixels;
+    /** the bytes of pixel buffers allocated during the stage */
+    size_t allocatedBytes;
+    /** the peak resident set size of the process by the end of the stage, in bytes */
+    size_t peakRSS;
+
+    /**
+     * Creates the stats of a stage that hasn't run yet.
+     * @param name what the stage did
+     */
+    explicit StageStats(std::string name = "") : name(name), count(0), wallSeconds(0), cpuSeconds(0),
+                                                 pixels(0), allocatedBytes(0), peakRSS(0) { }
+};
+
+/**
+ * StatsRecorder collects the stats of every stage of a run, in the order the
+ * stages first finished. Stages of the same name are added together. Every
+ * method is thread safe, so the stages of a batch can record from any of its
+ * threads.
+ *
+ * Processor time and allocations are counted for the whole process, so
+ * stages that overlap, as they do in a batch, are each charged for the
+ * others' work too.
+ */
+class StatsRecorder {
+private:
+    /** the stages recorded so far */
+    std::vector<StageStats> stages;
+    /** whether stages on different files are kept apart */
+    bool perFile;
+    /** guards stages */
+    mutable std::mutex lock;
+
+    StatsRecorder(const StatsRecorder&);
+    StatsRecorder& operator=(const StatsRecorder&);
+public:
+    /**
+     * Creates a recorder with no stages.
+     * @param perFile whether stages on different files are kept apart, rather
+     *        than added together as they are for a batch
+     */
+    explicit StatsRecorder(bool perFile = true) : perFile(perFile) { }
+
+    /**
+     * Names a stage that works on a file.
+     * @param stage what the stage does, such as "decode"
+     * @param filename the file it works on
+     * @return the stage followed by the filename, or just the stage if
+     *         files aren't kept apart
+     */
+    std::string getStageName(const std::string& stage, const std::string& filename) const {
+        return perFile ? stage + " " + filename : stage;
+    }
+    /**
+     * Adds one run of a stage.
+     * @param stage the stats of the run, with a count of 1
+     */
+    void record(const StageStats& stage) {
+        std::lock_guard<std::mutex> guard(lock);
+        for(int i = 0; i < stages.size(); i++)
+        {
+            if(stages[i].name == stage.name)
+            {
+                stages[i].count += stage.count;
+                stages[i].wallSeconds += stage.wallSeconds;
+                stages[i].cpuSeconds += stage.cpuSeconds;
+                stages[i].pixels += stage.pixels;
+                stages[i].allocatedBytes += stage.allocatedBytes;
+                stages[i].peakRSS = std::max(stages[i].peakRSS, stage.peakRSS);
+                return;
+            }
+        }
+        stages.push_back(stage);
+    }
+    /**
+     * Gets the stages recorded so far.
+     * @return a copy of the stats of each stage
+     */
+    std::vector<StageStats> getStages() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return stages;
+    }
+
+    /**
+     * Writes the stages as a table, one stage per line. The names come last
+     * so that long filenames don't push the other columns out of line.
+     * @param os the stream to write to
+     */
+    void writeTable(std::ostream& os) const {
+        std::vector<StageStats> stages = getStages();
+        os << std::setw(6) << "runs" << std::setw(11) << "wall ms" << std::setw(11) << "cpu ms"
+           << std::setw(11) << "Mpixels" << std::setw(11) << "Mpx/s" << std::setw(11) << "alloc MB"
+           << std::setw(11) << "peak MB" << "  stage" << std::endl;
+        os << std::fixed;
+        for(int i = 0; i < stages.size(); i++)
+        {
+            const StageStats& stage = stages[i];
+            double rate = stage.wallSeconds > 0 ? stage.pixels / stage.wallSeconds / 1e6 : 0;
+            os << std::setw(6) << stage.count
+               << std::setprecision(2) << std::setw(11) << stage.wallSeconds * 1e3
+               << std::setw(11) << stage.cpuSeconds * 1e3
+               << std::setprecision(3) << std::setw(11) << stage.pixels / 1e6
+               << std::setprecision(1) << std::setw(11) << rate
+               << std::setw(11) << stage.allocatedBytes / 1048576.0
+               << std::setw(11) << stage.peakRSS / 1048576.0
+               << "  " << stage.name << std::endl;
+        }
+        os.unsetf(std::ios::floatfield);
+    }
+    /**
+     * Writes the stages as a JSON object holding an array of stages, one
+     * stage per line. Times are in seconds and sizes in bytes.
+     * @param os the stream to write to
+     */
+    void writeJson(std::ostream& os) const {
+        std::vector<StageStats> stages = getStages();
+        os << "{\"stages\": [";
+        for(int i = 0; i < stages.size(); i++)
+        {
+            const StageStats& stage = stages[i];
+            os << (i > 0 ? ",\n  " : "\n  ") << "{\"name\": ";
+            writeJsonString(os, stage.name);
+            os << ", \"count\": " << stage.count
+               << ", \"wall_s\": " << stage.wallSeconds
+               << ", \"cpu_s\": " << stage.cpuSeconds
+               << ", \"pixels\": " << stage.pixels
+               << ", \"allocated_bytes\": " << stage.allocatedBytes
+               << ", \"peak_rss_bytes\": " << stage.peakRSS << "}";
+        }
+        os << "\n]}" << std::endl;
+    }
+};
+
+#ifdef IMANIP_STATS
+/**
+ * StageTimer measures one run of a stage, from when it is created to when it
+ * is finished, and records it. Without a recorder it does nothing, and if
+ * IMANIP_NO_STATS is defined it compiles to nothing at all. A stage that
+ * throws before it is finished isn't recorded.
+ */
+class StageTimer {
+private:
+    /** the recorder the stage is recorded in, or null */
+    StatsRecorder* recorder;
+    /** the stats of the stage so far */
+    StageStats stage;
+    /** when the stage started */
+    std::chrono::steady_clock::time_point wallStart;
+    /** the processor time used by the process when the stage started */
+    double cpuStart;
+    /** the bytes allocated from the buffer pool when the stage started */
+    size_t allocatedStart;
+public:
+    /**
+     * Starts timing a stage.
+     * @param recorder the recorder to record the stage in, or null to not record it
+     * @param name what the stage does
+     */
+    StageTimer(StatsRecorder* recorder, const std::string& name) : recorder(recorder), cpuStart(0), allocatedStart(0) {
+        if(recorder)
+        {
+            stage.name = name;
+            allocatedStart = getBufferPool().getStats().allocatedBytes;
+            cpuStart = getCPUSeconds();
+            wallStart = std::chrono::steady_clock::now();
+        }
+    }
+    /**
+     * Starts timing a stage that works on a file.
+     * @param recorder the recorder to record the stage in, or null to not record it
+     * @param name what the stage does
+     * @param filename the file it works on
+     */
+    StageTimer(StatsRecorder* recorder, const std::string& name, const std::string& filename)
+        : StageTimer(recorder, recorder ? recorder->getStageName(name, filename) : name) { }
+    /**
+     * Stops timing the stage and records it.
+     * @param pixels the number of pixels the stage was given, or decoded
+     */
+    void finish(long long pixels) {
+        if(!recorder)
+        {
+            return;
+        }
+        stage.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        stage.cpuSeconds = getCPUSeconds() - cpuStart;
+        stage.allocatedBytes = getBufferPool().getStats().allocatedBytes - allocatedStart;
+        stage.peakRSS = getPeakRSS();
+        stage.pixels = pixels;
+        stage.count = 1;
+        recorder->record(stage);
+        recorder = 0;
+    }
+};
+#else
+/**
+ * Stage timers are compiled out, so this does nothing.
+ */
+class StageTimer {
+public:
+    StageTimer(StatsRecorder*, const std::string&) { }
+    StageTimer(StatsRecorder*, const std::string&, const std::string&) { }
+    void finish(long long) { }
+};
+#endif
+
+}
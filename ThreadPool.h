@@ -0,0 +1,270 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Exceptions.h"
+
+namespace IManip {
+
+/** the number of pixels each chunk of a parallel loop over rows should cover */
+const int PARALLEL_GRAIN_PIXELS = 1 << 16;
+
+/**
+ * ThreadPool is a fixed set of worker threads that run tasks from a shared
+ * queue. The whole process shares one pool, from getThreadPool(), so that
+ * filters running side by side don't each start threads of their own.
+ * The thread that calls into the pool counts as one of its threads, so a pool
+ * of n threads has n - 1 workers.
+ */
+class ThreadPool {
+private:
+    /** the worker threads */
+    std::vector<std::thread> workers;
+    /** the tasks waiting for a worker */
+    std::deque<std::function<void()> > tasks;
+    /** guards tasks and stopping */
+    std::mutex lock;
+    /** signalled when a task is queued or the pool is stopping */
+    std::condition_variable taskReady;
+    /** whether the workers should finish up and exit */
+    bool stopping;
+
+    /**
+     * Runs tasks from the queue until the pool stops.
+     */
+    void work() {
+        while(true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                taskReady.wait(guard, [this] { return stopping || !tasks.empty(); });
+                if(tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+    /**
+     * Starts the given number of workers.
+     * @param workerCount the number of worker threads to start
+     */
+    void start(int workerCount) {
+        stopping = false;
+        for(int i = 0; i < workerCount; i++)
+        {
+            workers.push_back(std::thread(&ThreadPool::work, this));
+        }
+    }
+    /**
+     * Lets the workers finish the queued tasks, then joins them.
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        taskReady.notify_all();
+        for(int i = 0; i < workers.size(); i++)
+        {
+            workers[i].join();
+        }
+        workers.clear();
+    }
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+public:
+    /**
+     * Creates a pool with the given number of threads, counting the caller.
+     * @param threadCount the number of threads, at least 1
+     * @throws IllegalArgumentException if threadCount is less than 1
+     */
+    explicit ThreadPool(int threadCount) {
+        if(threadCount < 1)
+        {
+            throw IllegalArgumentException("A thread pool needs at least 1 thread.");
+        }
+        start(threadCount - 1);
+    }
+    /**
+     * Finishes the queued tasks and joins the workers.
+     */
+    ~ThreadPool() {
+        stop();
+    }
+
+    /**
+     * Gets the number of threads in the pool, counting the caller.
+     * @return the number of threads
+     */
+    int getThreadCount() const {
+        return workers.size() + 1;
+    }
+    /**
+     * Changes the number of threads in the pool. Queued tasks are finished by
+     * the old workers first. This must not be called from inside a task.
+     * @param threadCount the number of threads, at least 1
+     * @throws IllegalArgumentException if threadCount is less than 1
+     */
+    void setThreadCount(int threadCount) {
+        if(threadCount < 1)
+        {
+            throw IllegalArgumentException("A thread pool needs at least 1 thread.");
+        }
+        stop();
+        start(threadCount - 1);
+    }
+
+    /**
+     * Queues a task to be run by one of the workers.
+     * @param task the task to run
+     */
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            tasks.push_back(std::move(task));
+        }
+        taskReady.notify_one();
+    }
+};
+
+/**
+ * Gets the thread pool shared by the whole process. It starts with one thread
+ * per hardware thread.
+ * @return the shared pool
+ */
+ThreadPool& getThreadPool() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+/**
+ * The state of one parallelFor, shared between the caller and the workers
+ * helping it. It is reference counted, since a worker may only get to its
+ * task after the loop has finished.
+ */
+struct ParallelLoop {
+    /** the loop body, run over [begin, end) ranges */
+    std::function<void(int, int)> body;
+    /** the start of the whole range */
+    int begin;
+    /** the end of the whole range */
+    int end;
+    /** the size of each chunk */
+    int grain;
+    /** the number of chunks */
+    int chunkCount;
+    /** the next chunk to be claimed */
+    std::atomic<int> nextChunk;
+    /** the number of chunks finished */
+    int chunksDone;
+    /** the first exception thrown by the body, if any */
+    std::exception_ptr error;
+    /** guards chunksDone and error */
+    std::mutex lock;
+    /** signalled when the last chunk finishes */
+    std::condition_variable finished;
+
+    /**
+     * Claims and runs chunks until none are left.
+     */
+    void runChunks() {
+        int chunk;
+        while((chunk = nextChunk++) < chunkCount)
+        {
+            int chunkBegin = begin + chunk*grain;
+            int chunkEnd = std::min(end, chunkBegin + grain);
+            std::exception_ptr chunkError;
+            try
+            {
+                body(chunkBegin, chunkEnd);
+            }
+            catch(...)
+            {
+                chunkError = std::current_exception();
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            if(chunkError && !error)
+            {
+                error = chunkError;
+            }
+            if(++chunksDone == chunkCount)
+            {
+                finished.notify_all();
+            }
+        }
+    }
+};
+
+/**
+ * Runs a loop body over a range of indices split into chunks, spread over the
+ * shared thread pool. The calling thread works through chunks too, so it is
+ * safe to call parallelFor from inside another parallelFor or a pool task.
+ * @param begin the first index of the range
+ * @param end one past the last index of the range
+ * @param grain the number of indices in each chunk, at least 1
+ * @param body called with the [begin, end) of each chunk, possibly from
+ *        several threads at once
+ * @throws whatever the body throws, once every chunk has finished
+ */
+void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body) {
+    if(end <= begin)
+    {
+        return;
+    }
+    grain = std::max(1, grain);
+    int chunkCount = (end - begin + grain - 1) / grain;
+    ThreadPool& pool = getThreadPool();
+    int helpers = std::min(chunkCount, pool.getThreadCount()) - 1;
+    if(helpers <= 0)
+    {
+        body(begin, end);
+        return;
+    }
+
+    std::shared_ptr<ParallelLoop> loop = std::make_shared<ParallelLoop>();
+    loop->body = body;
+    loop->begin = begin;
+    loop->end = end;
+    loop->grain = grain;
+    loop->chunkCount = chunkCount;
+    loop->nextChunk = 0;
+    loop->chunksDone = 0;
+    for(int i = 0; i < helpers; i++)
+    {
+        pool.submit([loop] { loop->runChunks(); });
+    }
+    loop->runChunks();
+
+    std::unique_lock<std::mutex> guard(loop->lock);
+    loop->finished.wait(guard, [&loop] { return loop->chunksDone == loop->chunkCount; });
+    if(loop->error)
+    {
+        std::rethrow_exception(loop->error);
+    }
+}
+
+/**
+ * Runs a loop body over the rows of an image in bands, spread over the shared
+ * thread pool. Each band covers roughly PARALLEL_GRAIN_PIXELS pixels.
+ * @param width the width of the image in pixels
+ * @param height the number of rows
+ * @param body called with the [begin, end) rows of each band
+ */
+void parallelForRows(int width, int height, const std::function<void(int, int)>& body) {
+    parallelFor(0, height, PARALLEL_GRAIN_PIXELS / std::max(1, width), body);
+}
+
+}
@@ -0,0 +1,338 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Exceptions.h"
+
+namespace IManip {
+
+/** the most events each thread keeps, after which its oldest are overwritten */
+const size_t TRACE_BUFFER_EVENTS = 1 << 15;
+/** the longest event name kept, counting the terminating null */
+const int TRACE_NAME_LENGTH = 48;
+
+/**
+ * Writes a string as a quoted JSON string.
+ * @param os the stream to write to
+ * @param text the string to write
+ */
+void writeJsonString(std::ostream& os, const std::string& text) {
+    os << '"';
+    for(int i = 0; i < text.size(); i++)
+    {
+        unsigned char c = text[i];
+        if(c == '"' || c == '\\')
+        {
+            os << '\\' << c;
+        }
+        else if(c < 0x20)
+        {
+            os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c
+               << std::dec << std::setfill(' ');
+        }
+        else
+        {
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+/**
+ * One span of work on one thread, such as filtering an image.
+ */
+struct TraceEvent {
+    /** what was done, with its start cut to fit, so a filename keeps its end */
+    char name[TRACE_NAME_LENGTH];
+    /** the kind of work, a string literal */
+    const char* category;
+    /** when the work started, in microseconds from the start of the trace */
+    long long start;
+    /** how long the work took, in microseconds */
+    long long duration;
+    /** the width of the image worked on, or 0 */
+    int width;
+    /** the height of the image worked on, or 0 */
+    int height;
+};
+
+/**
+ * TraceBuffer is a ring of the latest events of a single thread. Only its own
+ * thread adds to it, so adding takes no lock: the event is written, then the
+ * count is published. The events are read once the traced work is done.
+ */
+class TraceBuffer {
+private:
+    /** the ring of events */
+    std::vector<TraceEvent> events;
+    /** the number of events ever added, so the next goes at written % size */
+    std::atomic<size_t> written;
+    /** the thread's id in the trace */
+    int threadId;
+    /** what the thread is for, or empty */
+    std::string threadName;
+public:
+    /**
+     * Creates an empty buffer.
+     * @param threadId the thread's id in the trace
+     */
+    explicit TraceBuffer(int threadId) : events(TRACE_BUFFER_EVENTS), written(0), threadId(threadId) { }
+
+    /**
+     * Adds an event, overwriting the oldest if the ring is full. Must only be
+     * called by the buffer's own thread.
+     * @param event the event to add
+     */
+    void add(const TraceEvent& event) {
+        size_t count = written.load(std::memory_order_relaxed);
+        events[count % events.size()] = event;
+        written.store(count + 1, std::memory_order_release);
+    }
+    /**
+     * Drops every event.
+     */
+    void clear() {
+        written.store(0, std::memory_order_release);
+    }
+    /**
+     * Names the thread in the trace. Must only be called by the buffer's own
+     * thread, or while it is idle.
+     * @param name what the thread is for
+     */
+    void setThreadName(const std::string& name) {
+        threadName = name;
+    }
+
+    /**
+     * Writes the events still in the ring as Chrome trace events, each
+     * followed by a comma and a newline.
+     * @param os the stream to write to
+     */
+    void writeJson(std::ostream& os) const {
+        if(!threadName.empty())
+        {
+            os << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << threadId
+               << ", \"args\": {\"name\": ";
+            writeJsonString(os, threadName);
+            os << "}},\n";
+        }
+        size_t count = written.load(std::memory_order_acquire);
+        size_t first = count > events.size() ? count - events.size() : 0;
+        for(size_t i = first; i < count; i++)
+        {
+            const TraceEvent& event = events[i % events.size()];
+            os << "{\"name\": ";
+            writeJsonString(os, event.name);
+            os << ", \"cat\": \"" << event.category << "\", \"ph\": \"X\", \"ts\": " << event.start
+               << ", \"dur\": " << event.duration << ", \"pid\": 1, \"tid\": " << threadId
+               << ", \"args\": {\"width\": " << event.width << ", \"height\": " << event.height << "}},\n";
+        }
+    }
+};
+
+/**
+ * Tracer records a timeline of the work done by every thread, to be viewed
+ * as a Chrome trace (chrome://tracing or Perfetto). Each thread adds its
+ * events to a ring buffer of its own, so tracing takes no locks once a
+ * thread has its buffer, and costs a single flag check while it is off.
+ * There is one tracer for the whole process, from getTracer().
+ */
+class Tracer {
+private:
+    /** the buffers of every thread that has traced anything, never freed */
+    std::vector<std::unique_ptr<TraceBuffer> > buffers;
+    /** guards buffers */
+    mutable std::mutex lock;
+    /** whether events are being recorded */
+    std::atomic<bool> enabled;
+    /** when the trace started */
+    std::chrono::steady_clock::time_point origin;
+
+    Tracer(const Tracer&);
+    Tracer& operator=(const Tracer&);
+public:
+    /**
+     * Creates a tracer that isn't recording.
+     */
+    Tracer() : enabled(false) { }
+
+    /**
+     * Checks whether events are being recorded.
+     * @return true between start and stop
+     */
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_acquire);
+    }
+    /**
+     * Drops any earlier events and starts recording. No traced work may be
+     * running.
+     */
+    void start() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for(int i = 0; i < buffers.size(); i++)
+            {
+                buffers[i]->clear();
+            }
+        }
+        origin = std::chrono::steady_clock::now();
+        enabled.store(true);
+    }
+    /**
+     * Stops recording, keeping the events recorded so far.
+     */
+    void stop() {
+        enabled.store(false);
+    }
+    /**
+     * Gets the time since the trace started.
+     * @return the time in microseconds
+     */
+    long long getTime() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - origin).count();
+    }
+    /**
+     * Adds a new buffer for a thread that hasn't traced anything yet.
+     * @return the new buffer, which lasts as long as the tracer
+     */
+    TraceBuffer* addBuffer() {
+        std::lock_guard<std::mutex> guard(lock);
+        buffers.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer(buffers.size() + 1)));
+        return buffers.back().get();
+    }
+
+    /**
+     * Writes every thread's events as a Chrome trace. No traced work may be
+     * running.
+     * @param os the stream to write to
+     */
+    void writeJson(std::ostream& os) const {
+        std::lock_guard<std::mutex> guard(lock);
+        os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        for(int i = 0; i < buffers.size(); i++)
+        {
+            buffers[i]->writeJson(os);
+        }
+        os << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"imanip\"}}\n]}" << std::endl;
+    }
+};
+
+/**
+ * Gets the tracer shared by the whole process. It is never destroyed, so
+ * threads may trace right up until the process exits.
+ * @return the shared tracer
+ */
+Tracer& getTracer() {
+    static Tracer* tracer = new Tracer();
+    return *tracer;
+}
+/**
+ * Gets the calling thread's trace buffer, adding one the first time.
+ * @return the buffer
+ */
+TraceBuffer& getTraceBuffer() {
+    static thread_local TraceBuffer* buffer = 0;
+    if(!buffer)
+    {
+        buffer = getTracer().addBuffer();
+    }
+    return *buffer;
+}
+/**
+ * Writes every thread's events to a Chrome trace file.
+ * @param filename the name of the JSON file to write
+ * @throws FileException if the file cannot be written
+ */
+void saveTrace(const std::string& filename) {
+    std::ofstream ofs(filename.c_str());
+    getTracer().writeJson(ofs);
+    ofs.close();
+    if(!ofs)
+    {
+        throw FileException(filename, "File cannot be written");
+    }
+}
+/**
+ * Names the calling thread in the trace, if tracing is on.
+ * @param name what the thread is for
+ */
+void nameTraceThread(const std::string& name) {
+    if(getTracer().isEnabled())
+    {
+        getTraceBuffer().setThreadName(name);
+    }
+}
+
+/**
+ * TraceScope records an event spanning its own lifetime on the calling
+ * thread, if tracing is on when it is created.
+ */
+class TraceScope {
+private:
+    /** the event being recorded */
+    TraceEvent event;
+    /** whether the event is recorded */
+    bool recording;
+
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+public:
+    /**
+     * Starts an event.
+     * @param category the kind of work, a string literal
+     * @param name what is being done, cut at the start if it is too long
+     * @param width the width of the image worked on, or 0 if it isn't known yet
+     * @param height the height of the image worked on, or 0 if it isn't known yet
+     */
+    TraceScope(const char* category, const char* name, int width = 0, int height = 0)
+        : recording(getTracer().isEnabled()) {
+        if(recording)
+        {
+            size_t length = std::strlen(name);
+            if(length < TRACE_NAME_LENGTH)
+            {
+                std::memcpy(event.name, name, length + 1);
+            }
+            else
+            {
+                // keep the end of the name, which is where a filename's basename is
+                std::memcpy(event.name, "...", 3);
+                std::memcpy(event.name + 3, name + length - (TRACE_NAME_LENGTH - 4), TRACE_NAME_LENGTH - 4);
+                event.name[TRACE_NAME_LENGTH - 1] = 0;
+            }
+            event.category = category;
+            event.width = width;
+            event.height = height;
+            event.start = getTracer().getTime();
+        }
+    }
+    /**
+     * Ends the event and records it.
+     */
+    ~TraceScope() {
+        if(recording)
+        {
+            event.duration = getTracer().getTime() - event.start;
+            getTraceBuffer().add(event);
+        }
+    }
+    /**
+     * Sets the size of the image worked on, once it is known.
+     * @param width the width of the image
+     * @param height the height of the image
+     */
+    void setSize(int width, int height) {
+        event.width = width;
+        event.height = height;
+    }
+};
+
+}
@@ -27,6 +27,7 @@ void runTests() {
 }
 
 int main(int argc, const char** argv) {
+    int status = 0;
     try {
         if(argc > 1 && string(argv[1]) == "-test")
         {
@@ -34,15 +35,17 @@ int main(int argc, const char** argv) {
         }
         else
         {
-            parseAndRun(argc - 1, argv + 1);
+            status = parseAndRun(argc - 1, argv + 1);
         }
     }
     catch(FileException ex) {
         cout << ex.getMessage() << ": " << ex.getFilename() << endl;
+        status = 1;
     }
     catch(Exception ex) {
         cout << ex.getMessage() << endl;
+        status = 1;
     }
     
-    return 0;
+    return status;
 }